@@ -0,0 +1,197 @@
+/*
+ * arenatest.c - Check that an arena which runs out of room fails its
+ *     requests with NULL, and works again once blocks are freed.
+ *
+ * Each test fills a small arena with blocks of one kind until a request
+ * fails, checks that the blocks stay within max_size and don't overlap,
+ * then frees every other block and checks that the holes take the same
+ * requests again, and finally frees everything and fills the arena once
+ * more. The main heap is used alongside to make sure a full arena
+ * leaves it alone. Prints one line per test and exits with 1 if any of
+ * them failed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define ARENA_SIZE (1 << 20)   /* max_size of the arenas under test */
+#define MAX_BLOCKS 100000      /* more than any arena can hold */
+
+/* One kind of request: a size and, if not 0, an alignment. An aligned
+ * request only takes a free block with room for the worst-case slack in
+ * front of it, more than the hole a single freed block leaves, so
+ * aligned kinds skip the holes. */
+typedef struct {
+    char *name;
+    size_t size;
+    size_t align;
+} request_t;
+
+static request_t requests[] = {
+    { "64KB malloc", 64 * 1024, 0 },
+    { "small malloc", 48, 0 },
+    { "4KB memalign", 3000, 4096 },
+};
+
+static void *blocks[MAX_BLOCKS];
+static int finished;   /* set once every test has run */
+
+/*
+ * early_exit - the allocator gave up on an out-of-memory arena and called
+ *     exit itself, which must not pass for success
+ */
+static void early_exit(void)
+{
+    if (!finished) {
+        fprintf(stderr, "exit called before the tests finished\n");
+        _exit(1);
+    }
+}
+
+/*
+ * arena_request - make one request of kind r on arena
+ */
+static void *arena_request(mm_arena_t *arena, request_t *r)
+{
+    return r->align ? mm_arena_memalign(arena, r->align, r->size) :
+        mm_arena_malloc(arena, r->size);
+}
+
+/*
+ * fill - make requests of kind r on arena until one fails, filling each
+ *     block with its index. Returns how many succeeded, or -1 if a block
+ *     is out of place.
+ */
+static int fill(mm_arena_t *arena, request_t *r)
+{
+    char *lo = NULL, *hi = NULL;
+    int n;
+
+    for (n = 0; n < MAX_BLOCKS; n++) {
+        char *p = arena_request(arena, r);
+        if (p == NULL)
+            break;
+        if (r->align && (unsigned long)p % r->align) {
+            fprintf(stderr, "%s: block %d not aligned\n", r->name, n);
+            return -1;
+        }
+        if (lo == NULL || p < lo)
+            lo = p;
+        if (hi == NULL || p + r->size > hi)
+            hi = p + r->size;
+        memset(p, n & 0xff, r->size);
+        blocks[n] = p;
+    }
+    if (n == 0 || n == MAX_BLOCKS || hi - lo > ARENA_SIZE) {
+        fprintf(stderr, "%s: %d blocks over %ld bytes\n", r->name, n,
+                (long)(hi - lo));
+        return -1;
+    }
+    return n;
+}
+
+/*
+ * intact - check that none of the first n blocks got overwritten
+ */
+static int intact(request_t *r, int n)
+{
+    int i;
+    size_t j;
+
+    for (i = 0; i < n; i++) {
+        if (blocks[i] == NULL)
+            continue;
+        for (j = 0; j < r->size; j++) {
+            if (((unsigned char *)blocks[i])[j] != (i & 0xff)) {
+                fprintf(stderr, "%s: block %d overwritten\n", r->name, i);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * run_test - fill an arena with requests of kind r, free every other
+ *     block and fill the holes, then free everything and fill it again
+ */
+static int run_test(request_t *r)
+{
+    mm_arena_t *arena;
+    void *outside;
+    int i, n, again, ok = 0;
+
+    if ((arena = mm_arena_create(ARENA_SIZE)) == NULL) {
+        fprintf(stderr, "%s: mm_arena_create failed\n", r->name);
+        return 0;
+    }
+
+    if ((n = fill(arena, r)) < 0)
+        goto out;
+
+    /* a full arena doesn't stop the main heap */
+    if ((outside = mm_malloc(r->size)) == NULL) {
+        fprintf(stderr, "%s: mm_malloc failed next to a full arena\n",
+                r->name);
+        goto out;
+    }
+    mm_free(outside);
+
+    /* every freed block makes room for one more */
+    for (i = 0; i < n && !r->align; i += 2) {
+        mm_arena_free(arena, blocks[i]);
+        blocks[i] = NULL;
+    }
+    for (i = 0; i < n && !r->align; i += 2) {
+        if ((blocks[i] = arena_request(arena, r)) == NULL) {
+            fprintf(stderr, "%s: no room for block %d after free\n",
+                    r->name, i);
+            goto out;
+        }
+        memset(blocks[i], i & 0xff, r->size);
+    }
+    if (!intact(r, n))
+        goto out;
+
+    /* and an emptied arena holds about as much as it did the first time
+       (slabs and aligned slack can land a little differently) */
+    for (i = 0; i < n; i++)
+        mm_arena_free(arena, blocks[i]);
+    if ((again = fill(arena, r)) < 0 || !intact(r, again))
+        goto out;
+    if (again < n - n / 64) {
+        fprintf(stderr, "%s: %d blocks at first, %d after freeing them\n",
+                r->name, n, again);
+        goto out;
+    }
+    ok = 1;
+
+out:
+    printf("%-14s %s\n", r->name, ok ? "ok" : "FAILED");
+    mm_arena_destroy(arena);
+    return ok;
+}
+
+int main(void)
+{
+    int i, failed = 0;
+
+    atexit(early_exit);
+    mem_init();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+
+    for (i = 0; i < (int)(sizeof(requests) / sizeof(requests[0])); i++)
+        if (!run_test(&requests[i]))
+            failed++;
+
+    finished = 1;
+    mem_deinit();
+    exit(failed ? 1 : 0);
+}
@@ -32,7 +32,9 @@
   "binary-bal.rep",\
   "binary2-bal.rep",\
   "bdd-aa4.rep", \
-  "bdd-ma4.rep"
+  "bdd-ma4.rep", \
+  "realloc-bal.rep", \
+  "realloc2-bal.rep"
 
 /*
  * This constant gives the estimated performance of the libc malloc
@@ -58,9 +60,12 @@
 #define ALIGNMENT 16  
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes. memlib only reserves this much address
+ * space up front; pages are committed as the heap grows into it, in
+ * chunks of MEM_COMMIT_CHUNK bytes.
  */
-#define MAX_HEAP (40*(1<<20))  /* 40 MB */
+#define MAX_HEAP (16UL << 30)  /* 16 GB */
+#define MEM_COMMIT_CHUNK (64 * 1024)
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
@@ -20,7 +20,9 @@
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -38,30 +40,37 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload. The ranges form a treap
+   (a search tree on lo that is also a heap on a hash of lo), so checking
+   and removing a block is O(log n) instead of a walk over all of them */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges below this one */
+    struct range_t *right; /* ranges above this one */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+/* Range records come from a pool, RANGE_POOL_CHUNK at a time */
+#define RANGE_POOL_CHUNK 4096
+
+/* 
+ * Latency histogram (-L). Like an HDR histogram it is log-linear: the
+ * values below 2*LAT_SUB get a bucket each, and every power of two
+ * above that is split into LAT_SUB equal buckets, so a bucket is never
+ * wider than 1/LAT_SUB of the values in it.
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
 
-/* Holds the information for one trace file*/
 typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
+    unsigned long count;               /* requests timed */
+    unsigned long max;                 /* slowest of them, in cycles */
+    unsigned long buckets[LAT_BUCKETS];
+} latency_t;
+
+/* The request types timed separately, and the rows they print as */
+enum {LAT_MALLOC, LAT_CALLOC, LAT_REALLOC, LAT_FREE, LAT_ALL, LAT_TYPES};
 
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
@@ -90,6 +99,9 @@ typedef struct {
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
+static range_t *range_pool = NULL; /* unused range records, linked by right */
+static int sized_free = 0; /* if set, frees go through mm_free_sized (-s) */
+static int latency = 0; /* if set, report per-request latencies (-L) */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
@@ -107,7 +119,7 @@ static char *default_tracefiles[] = {
  *********************/
 
 /* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
@@ -125,6 +137,7 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, int tracenum);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
@@ -158,7 +171,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalsL")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -181,6 +194,12 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 's': /* Replay frees with their sizes */
+            sized_free = 1;
+            break;
+        case 'L': /* Time every request and print latency percentiles */
+            latency = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -274,6 +293,8 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (latency)
+		eval_mm_latency(trace, i);
 	}
 	free_trace(trace);
     }
@@ -338,23 +359,32 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/* Treap priority of a range, a multiplicative hash of its address */
+static unsigned long range_priority(char *lo)
+{
+    return ((unsigned long)lo >> 4) * 0x9E3779B97F4A7C15UL;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     size bytes at addr lo, aligned to align bytes if align isn't 0.
+ *     After checking the block for correctness, we create a range
+ *     struct for this block and add it to the range list. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *q;
+    range_t **leftpp, **rightpp;
     char msg[MAXLINE];
+    int i;
 
     assert(size > 0);
 
@@ -366,71 +396,132 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* ...and to whatever alignment the request asked for */
+    if (align && ((size_t)lo) % align != 0) {
+	sprintf(msg, "Payload address (%p) not aligned to the requested "
+		"%d bytes", lo, align);
+        malloc_error(tracenum, opnum, msg);
+        return 0;
+    }
+
+    /* The payload must lie within the extent of the heap, or within
+       one of the mappings memlib handed out for huge blocks */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_in_mapping(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
+    /* 
+     * The payload must not overlap any other payloads. Those don't
+     * overlap each other, so only the last one starting at or below hi
+     * can reach into it.
+     */
+    for (p = *ranges, q = NULL;  p != NULL; )
+        if (p->lo <= hi) {
+            q = p;
+            p = p->right;
         }
+        else
+            p = p->left;
+    if (q != NULL && q->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, q->lo, q->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by taking a range struct from the pool and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    if (range_pool == NULL) {
+	if ((p = (range_t *)malloc(RANGE_POOL_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in add_range");
+	for (i = 0; i < RANGE_POOL_CHUNK; i++) {
+	    p[i].right = range_pool;
+	    range_pool = &p[i];
+	}
+    }
+    p = range_pool;
+    range_pool = p->right;
     p->lo = lo;
     p->hi = hi;
+
+    /* Go down until p's priority beats the subtree's root... */
+    while (*ranges != NULL && range_priority((*ranges)->lo) > range_priority(lo))
+        ranges = lo < (*ranges)->lo ? &(*ranges)->left : &(*ranges)->right;
+
+    /* ...and split that subtree around p, which takes its place */
+    q = *ranges;
+    leftpp = &p->left;
+    rightpp = &p->right;
+    while (q != NULL)
+        if (q->lo < lo) {
+            *leftpp = q;
+            leftpp = &q->right;
+            q = q->right;
+        }
+        else {
+            *rightpp = q;
+            rightpp = &q->left;
+            q = q->left;
+        }
+    *leftpp = NULL;
+    *rightpp = NULL;
     *ranges = p;
     return 1;
 }
 
 /* 
- * remove_range - Free the range record of block whose payload starts at lo 
+ * remove_range - Return the range record of the block whose payload starts
+ *     at lo to the pool
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    //int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            //size = p->hi - p->lo + 1;
-            free(p);
-            break;
+    range_t *p, *left, *right;
+
+    while (*ranges != NULL && (*ranges)->lo != lo)
+        ranges = lo < (*ranges)->lo ? &(*ranges)->left : &(*ranges)->right;
+    if ((p = *ranges) == NULL)
+        return;
+
+    /* Merge its two subtrees in its place */
+    left = p->left;
+    right = p->right;
+    while (left != NULL && right != NULL)
+        if (range_priority(left->lo) > range_priority(right->lo)) {
+            *ranges = left;
+            ranges = &left->right;
+            left = left->right;
         }
-        prevpp = &(p->next);
-    }
+        else {
+            *ranges = right;
+            ranges = &right->left;
+            right = right->left;
+        }
+    *ranges = left != NULL ? left : right;
+
+    p->right = range_pool;
+    range_pool = p;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - return all of the range records for a trace to the pool
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    range_t *p = *ranges;
+
+    if (p == NULL)
+        return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    p->right = range_pool;
+    range_pool = p;
     *ranges = NULL;
 }
 
@@ -444,13 +535,8 @@ static void clear_ranges(range_t **ranges)
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -459,21 +545,15 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
 	
-    /* Read the trace file header */
+    /* Load the requests, text or compiled (trace_load says what's wrong) */
     strcpy(path, tracedir);
     strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+    if (trace_load(path, trace) < 0)
+	exit(1);
+
+    /* Decode the packed requests up front, so that the timed loops
+       replay them without paying for the decoding */
+    if ((trace->requests = trace_decode(trace)) == NULL)
 	unix_error("malloc 2 failed in read_trace");
 
     /* We'll keep an array of pointers to the allocated blocks here... */
@@ -486,46 +566,18 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
     
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
     return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * free_trace - Free the trace record, its requests and the two arrays
+ *              it points to, all of which were set up in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
+    trace_unload(trace);      /* give back the requests... */
+    free(trace->requests);    /* free the three arrays... */
+    free(trace->blocks);
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
 }
@@ -540,10 +592,14 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i;
+    int i, j;
     int index;
     int size;
+    int oldsize;
+    char *newp;
+    char *oldp;
     char *p;
+    const traceop_t *op;
     
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
@@ -557,16 +613,25 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+	op = &trace->requests[i];
+	index = op->index;
+	size = op->size;
 
-        switch (trace->ops[i].type) {
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
-
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+        case CALLOC: /* mm_calloc */
+
+	    /* Call the student's malloc or calloc */
+	    if (op->type == CALLOC)
+		p = mm_calloc(1, size);
+	    else if (op->align)
+		p = mm_memalign(op->align, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, op->type == CALLOC ?
+			     "mm_calloc failed." : "mm_malloc failed.");
 		return 0;
 	    }
 	    
@@ -575,8 +640,19 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * to the range list if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(ranges, p, size, op->align, tracenum, i) == 0)
 		return 0;
+
+	    /* A calloc'd block must come back all zero */
+	    if (op->type == CALLOC) {
+		for (j = 0; j < size; j++) {
+		    if (p[j] != 0) {
+			malloc_error(tracenum, i, "mm_calloc did not zero "
+				     "the block");
+			return 0;
+		    }
+		}
+	    }
 	    
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
@@ -590,12 +666,52 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    trace->block_sizes[index] = size;
 	    break;
 
+        case REALLOC: /* mm_realloc */
+	    
+	    /* Call the student's realloc */
+	    oldp = trace->blocks[index];
+	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		return 0;
+	    }
+	    
+	    /* Remove the old region from the range list */
+	    remove_range(ranges, oldp);
+	    
+	    /* Check new block for correctness and add it to range list */
+	    if (add_range(ranges, newp, size, 0, tracenum, i) == 0)
+		return 0;
+	    
+	    /* ADDED: cgw
+	     * Make sure that the new block contains the data from the old 
+	     * block and then fill in the new block with the low order byte
+	     * of the new index
+	     */
+	    oldsize = trace->block_sizes[index];
+	    if (size < oldsize) oldsize = size;
+	    for (j = 0; j < oldsize; j++) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
+		malloc_error(tracenum, i, "mm_realloc did not preserve the "
+			     "data from old block");
+		return 0;
+	      }
+	    }
+	    memset(newp, index & 0xFF, size);
+
+	    /* Remember region */
+	    trace->blocks[index] = newp;
+	    trace->block_sizes[index] = size;
+	    break;
+
         case FREE: /* mm_free */
 	    
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    if (sized_free)
+		mm_free_sized(p, trace->block_sizes[index]);
+	    else
+		mm_free(p);
 	    break;
 
 	default:
@@ -613,20 +729,21 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   high water mark of the heap in bytes while running the student's
+ *   malloc package on the trace. mem_sbrk() lets the package shrink
+ *   the heap, so this is mem_heap_peak() rather than the final size.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
     int i;
     int index;
-    int size;
+    int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
     char *p;
+    char *newp, *oldp;
+    const traceop_t *op;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
@@ -634,13 +751,21 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+	op = &trace->requests[i];
+        switch (op->type) {
 
         case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-
-	    if ((p = mm_malloc(size)) == NULL) 
+        case CALLOC: /* mm_calloc */
+	    index = op->index;
+	    size = op->size;
+
+	    if (op->type == CALLOC)
+		p = mm_calloc(1, size);
+	    else if (op->align)
+		p = mm_memalign(op->align, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -656,12 +781,37 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 		total_size : max_total_size;
 	    break;
 
+	case REALLOC: /* mm_realloc */
+	    index = op->index;
+	    newsize = op->size;
+	    oldsize = trace->block_sizes[index];
+
+	    oldp = trace->blocks[index];
+	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+		app_error("mm_realloc failed in eval_mm_util");
+	    
+	    /* Remember region and size */
+	    trace->blocks[index] = newp;
+	    trace->block_sizes[index] = newsize;
+	    
+	    /* Keep track of current total size
+	     * of all allocated blocks */
+	    total_size += (newsize - oldsize);
+	    
+	    /* Update statistics */
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
         case FREE: /* mm_free */
-	    index = trace->ops[i].index;
+	    index = op->index;
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    if (sized_free)
+		mm_free_sized(p, size);
+	    else
+		mm_free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -675,7 +825,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_heap_peak());
 }
 
 
@@ -685,9 +835,10 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size;
-    char *p, *block;
+    int i, index, size, newsize;
+    char *p, *block, *oldp, *newp;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    const traceop_t *op;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
@@ -695,26 +846,214 @@ static void eval_mm_speed(void *ptr)
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    for (i = 0;  i < trace->num_ops;  i++) {
+	op = &trace->requests[i];
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            index = op->index;
+            size = op->size;
+            if (op->align)
+		p = mm_memalign(op->align, size);
+	    else
+		p = mm_malloc(size);
+            if (p == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case CALLOC: /* mm_calloc */
+            index = op->index;
+            size = op->size;
+            if ((p = mm_calloc(1, size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    index = op->index;
+            newsize = op->size;
+	    oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+		app_error("mm_realloc error in eval_mm_speed");
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op->index;
             block = trace->blocks[index];
-            mm_free(block);
+            if (sized_free)
+                mm_free_sized(block, trace->block_sizes[index]);
+            else
+                mm_free(block);
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+    }
+}
+
+/*
+ * lat_bucket - the histogram bucket that cycles falls in
+ */
+static int lat_bucket(unsigned long cycles)
+{
+    int shift = 0;
+
+    while ((cycles >> shift) >= 2 * LAT_SUB)
+        shift++;
+    return shift * LAT_SUB + (int)(cycles >> shift);
+}
+
+/*
+ * lat_bucket_top - the largest value that lands in bucket b
+ */
+static unsigned long lat_bucket_top(int b)
+{
+    int shift = b < 2 * LAT_SUB ? 0 : b / LAT_SUB - 1;
+
+    return ((unsigned long)(b - shift * LAT_SUB + 1) << shift) - 1;
+}
+
+/*
+ * lat_record - add a request that took cycles to hist
+ */
+static void lat_record(latency_t *hist, unsigned long cycles)
+{
+    hist->buckets[lat_bucket(cycles)]++;
+    hist->count++;
+    if (cycles > hist->max)
+        hist->max = cycles;
+}
+
+/*
+ * lat_percentile - the latency that fraction q of the requests in hist
+ *     took no longer than, to within a bucket
+ */
+static unsigned long lat_percentile(latency_t *hist, double q)
+{
+    unsigned long rank = (unsigned long)(q * hist->count + 0.999999);
+    unsigned long seen = 0;
+    int b;
+
+    if (rank == 0)
+        rank = 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen >= rank)
+            return lat_bucket_top(b) < hist->max ? lat_bucket_top(b) : hist->max;
+    }
+    return hist->max;
+}
+
+/*
+ * eval_mm_latency - Replay the trace once more with every request timed
+ *     on its own by the cycle counter, and print the latency percentiles
+ *     of each request type. The cost of reading the counter, measured
+ *     with ovhd(), is taken off every sample.
+ */
+static void eval_mm_latency(trace_t *trace, int tracenum)
+{
+    static const char *names[LAT_TYPES] = {
+        "malloc", "calloc", "realloc", "free", "all"
+    };
+    int i, t, index, size;
+    char *p;
+    double cycles, overhead;
+    latency_t *hist;
+    const traceop_t *op;
+
+    if ((hist = (latency_t *)calloc(LAT_TYPES, sizeof(latency_t))) == NULL)
+	unix_error("calloc failed in eval_mm_latency");
+
+    /* The overhead is the least of a few tries, the rest are noise */
+    overhead = ovhd();
+    for (i = 0; i < 9; i++)
+        if ((cycles = ovhd()) < overhead)
+            overhead = cycles;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	op = &trace->requests[i];
+        index = op->index;
+        size = op->size;
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc */
+            t = LAT_MALLOC;
+            start_counter();
+            p = op->align ? mm_memalign(op->align, size) : mm_malloc(size);
+            cycles = get_counter();
+            if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case CALLOC: /* mm_calloc */
+            t = LAT_CALLOC;
+            start_counter();
+            p = mm_calloc(1, size);
+            cycles = get_counter();
+            if (p == NULL)
+		app_error("mm_calloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            t = LAT_REALLOC;
+            start_counter();
+            p = mm_realloc(trace->blocks[index], size);
+            cycles = get_counter();
+            if (p == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* mm_free */
+            t = LAT_FREE;
+            p = trace->blocks[index];
+            start_counter();
+            if (sized_free)
+                mm_free_sized(p, trace->block_sizes[index]);
+            else
+                mm_free(p);
+            cycles = get_counter();
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	    return;
+        }
+
+        cycles = cycles > overhead ? cycles - overhead : 0;
+        lat_record(&hist[t], (unsigned long)cycles);
+        lat_record(&hist[LAT_ALL], (unsigned long)cycles);
+    }
+
+    printf("\nLatency for trace %d in cycles (%.0f of timer overhead taken off):\n",
+           tracenum, overhead);
+    printf("%-8s%10s%9s%9s%9s%9s%11s\n",
+           "request", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (t = 0; t < LAT_TYPES; t++) {
+        if (hist[t].count == 0)
+            continue;
+        printf("%-8s%10lu%9lu%9lu%9lu%9lu%11lu\n", names[t], hist[t].count,
+               lat_percentile(&hist[t], 0.5), lat_percentile(&hist[t], 0.9),
+               lat_percentile(&hist[t], 0.99), lat_percentile(&hist[t], 0.999),
+               hist[t].max);
+    }
+    free(hist);
 }
 
 /*
@@ -725,22 +1064,46 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i;
-    char *p;
+    int i, newsize;
+    char *p, *newp, *oldp;
+    const traceop_t *op;
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+	op = &trace->requests[i];
+        switch (op->type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+	    if (op->align)
+		p = aligned_alloc(op->align, op->size);
+	    else
+		p = malloc(op->size);
+	    if (p == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
+	    trace->blocks[op->index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    if ((p = calloc(1, op->size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[op->index] = p;
+	    break;
+	    
+        case REALLOC: /* realloc */
+            newsize = op->size;
+	    oldp = trace->blocks[op->index];
+	    if ((newp = realloc(oldp, newsize)) == NULL) {
+		malloc_error(tracenum, i, "libc realloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[op->index] = newp;
 	    break;
 	    
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    free(trace->blocks[op->index]);
 	    break;
 
 	default:
@@ -759,22 +1122,45 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 static void eval_libc_speed(void *ptr)
 {
     int i;
-    int index, size;
-    char *p, *block;
+    int index, size, newsize;
+    char *p, *block, *oldp, *newp;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    const traceop_t *op;
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+	op = &trace->requests[i];
+        switch (op->type) {
         case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
+	    index = op->index;
+	    size = op->size;
+	    if (op->align)
+		p = aligned_alloc(op->align, size);
+	    else
+		p = malloc(size);
+	    if (p == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
 
+	case CALLOC: /* calloc */
+	    index = op->index;
+	    size = op->size;
+	    if ((p = calloc(1, size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+	    index = op->index;
+	    newsize = op->size;
+	    oldp = trace->blocks[index];
+	    if ((newp = realloc(oldp, newsize)) == NULL)
+		unix_error("realloc failed in eval_libc_speed");
+	    trace->blocks[index] = newp;
+	    break;
+
         case FREE: /* free */
-	    index = trace->ops[i].index;
+	    index = op->index;
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
@@ -876,12 +1262,14 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValsL] [-f <file>] [-t <dir>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print per-request latency percentiles.\n");
+    fprintf(stderr, "\t-s         Free with mm_free_sized instead of mm_free.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
@@ -2,7 +2,20 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * Each heap reserves MAX_HEAP bytes of address space with mmap(PROT_NONE)
+ * and makes pages accessible MEM_COMMIT_CHUNK bytes at a time as the brk
+ * pointer passes them, so a big MAX_HEAP costs nothing until it's used.
+ * Shrinking the heap hands whole pages back to the OS with madvise.
+ * Each heap also remembers how far up it has ever been handed out since
+ * its pages were last zeroed (its dirty watermark), so a calloc can skip
+ * clearing memory that nobody has written yet.
+ *
+ * Blocks too big for the heap can get a mapping of their own with
+ * mem_map. Those are real mmaps; memlib keeps a list of them so that the
+ * driver can tell a mapped payload from a stray pointer.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,75 +27,197 @@
 #include "memlib.h"
 #include "config.h"
 
+/* A mapping handed out by mem_map */
+typedef struct mem_mapping {
+  char *start;
+  size_t size;
+  struct mem_mapping *next;
+} mem_mapping_t;
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */
+static mem_region_t mem_heap;  /* the heap set up by mem_init */
+static mem_mapping_t *mem_mappings;  /* live mappings, newest first */
+static size_t mem_mapped;      /* bytes in live mappings */
+static size_t mem_peak;        /* largest heap + mappings since the last reset */
+
+static void mem_update_peak(void);
+
+static int mem_region_reserve(mem_region_t *region, size_t max_size);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void) {
-  /* allocate the storage we will use to model the available VM */
-  if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-    fprintf(stderr, "mem_init_vm: malloc error\n");
+  /* reserve the address space we will use to model the available VM */
+  if (mem_region_reserve(&mem_heap, MAX_HEAP) < 0) {
+    fprintf(stderr, "mem_init_vm: mmap error\n");
     exit(1);
   }
-
-  mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-  mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void) {
-  free(mem_start_brk);
+  munmap(mem_heap.start_brk, mem_heap.max_addr - mem_heap.start_brk);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap.
+ *    The pages stay committed, so replaying a trace doesn't fault them
+ *    all in again.
  */
 void mem_reset_brk() {
-  mem_brk = mem_start_brk;
+  mem_heap.brk = mem_heap.start_brk;
+  mem_heap.peak_brk = mem_heap.start_brk;
+
+  /* whatever is still mapped belonged to the old heap */
+  while (mem_mappings)
+    mem_unmap(mem_mappings->start);
+  mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area, or
+ *    shrinks it if incr is negative and returns the old brk.
  */
-void *mem_sbrk(size_t incr) {
-  char *old_brk = mem_brk;
-
-  if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ) {
-    errno = ENOMEM;
-    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-    return (void *)-1;
-  }
-  mem_brk += incr;
-  return (void *)old_brk;
+void *mem_sbrk(intptr_t incr) {
+  return mem_region_sbrk(&mem_heap, incr);
 }
 
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo() {
-  return (void *)mem_start_brk;
+  return mem_region_lo(&mem_heap);
 }
 
 /* 
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi() {
-  return (void *)(mem_brk - 1);
+  return mem_region_hi(&mem_heap);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
 size_t mem_heapsize() {
-  return (size_t)(mem_brk - mem_start_brk);
+  return mem_region_size(&mem_heap);
+}
+
+/*
+ * mem_heap_peak() - returns the largest the heap and the mappings from
+ *    mem_map have been together, in bytes, since the heap was last reset
+ */
+size_t mem_heap_peak() {
+  return mem_peak;
+}
+
+/*
+ * mem_heap_dirty_end() - returns the heap's dirty watermark: every byte
+ *    from there up has never been handed out since it was zeroed
+ */
+void *mem_heap_dirty_end() {
+  return mem_region_dirty_end(&mem_heap);
+}
+
+/*
+ * mem_update_peak - account for a bigger heap or a new mapping
+ */
+static void mem_update_peak() {
+  if (mem_heapsize() + mem_mapped > mem_peak)
+    mem_peak = mem_heapsize() + mem_mapped;
+}
+
+/*
+ * mem_map - map size bytes (rounded up to whole pages) of fresh,
+ *    zeroed memory outside the heap. Returns NULL on error.
+ */
+void *mem_map(size_t size) {
+  mem_mapping_t *m;
+  void *start;
+
+  size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+  if ((m = (mem_mapping_t *)malloc(sizeof(mem_mapping_t))) == NULL)
+    return NULL;
+  start = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (start == MAP_FAILED) {
+    free(m);
+    return NULL;
+  }
+
+  m->start = (char *)start;
+  m->size = size;
+  m->next = mem_mappings;
+  mem_mappings = m;
+  mem_mapped += size;
+  mem_update_peak();
+  return start;
+}
+
+/*
+ * mem_find_mapping - the list link pointing at the mapping that
+ *    starts at start
+ */
+static mem_mapping_t **mem_find_mapping(void *start) {
+  mem_mapping_t **m;
+
+  for (m = &mem_mappings; *m != NULL; m = &(*m)->next)
+    if ((*m)->start == (char *)start)
+      return m;
+  fprintf(stderr, "ERROR: %p is not a mapping from mem_map\n", start);
+  exit(1);
+}
+
+/*
+ * mem_unmap - give a mapping from mem_map back to the OS
+ */
+void mem_unmap(void *start) {
+  mem_mapping_t **link = mem_find_mapping(start);
+  mem_mapping_t *m = *link;
+
+  munmap(m->start, m->size);
+  mem_mapped -= m->size;
+  *link = m->next;
+  free(m);
+}
+
+/*
+ * mem_remap - resize a mapping from mem_map to size bytes (rounded up
+ *    to whole pages), moving it if it can't grow where it is. The
+ *    contents are kept. Returns the new start, or NULL on error, in
+ *    which case the old mapping is left alone.
+ */
+void *mem_remap(void *start, size_t size) {
+  mem_mapping_t *m = *mem_find_mapping(start);
+  void *new_start;
+
+  size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+  new_start = mremap(m->start, m->size, size, MREMAP_MAYMOVE);
+  if (new_start == MAP_FAILED)
+    return NULL;
+
+  mem_mapped += size - m->size;
+  m->start = (char *)new_start;
+  m->size = size;
+  mem_update_peak();
+  return new_start;
+}
+
+/*
+ * mem_in_mapping - returns 1 if lo..hi (inclusive) lies in a single
+ *    mapping from mem_map, 0 otherwise
+ */
+int mem_in_mapping(void *lo, void *hi) {
+  mem_mapping_t *m;
+
+  for (m = mem_mappings; m != NULL; m = m->next)
+    if ((char *)lo >= m->start && (char *)hi < m->start + m->size)
+      return 1;
+  return 0;
 }
 
 /*
@@ -92,3 +227,150 @@ size_t mem_pagesize() {
   return (size_t)getpagesize();
 }
 
+/*
+ * mem_default_region - the region behind mem_sbrk and friends
+ */
+mem_region_t *mem_default_region() {
+  return &mem_heap;
+}
+
+/*
+ * mem_region_reserve - reserve max_size bytes of address space for an
+ *    empty region, none of it committed yet. Returns -1 on error.
+ */
+static int mem_region_reserve(mem_region_t *region, size_t max_size) {
+  void *start;
+
+  max_size = (max_size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+  start = mmap(NULL, max_size, PROT_NONE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (start == MAP_FAILED)
+    return -1;
+
+  region->start_brk = (char *)start;
+  region->brk = region->start_brk;         /* heap is empty initially */
+  region->commit_brk = region->start_brk;  /* and nothing is committed */
+  region->peak_brk = region->start_brk;
+  region->dirty_brk = region->start_brk;   /* and all of it is zero */
+  region->max_addr = region->start_brk + max_size;  /* max legal heap address */
+  return 0;
+}
+
+/*
+ * mem_region_create - model another, independent heap of up to
+ *    max_size bytes (MAX_HEAP if max_size is 0). Returns NULL if the
+ *    address space can't be reserved.
+ */
+mem_region_t *mem_region_create(size_t max_size) {
+  mem_region_t *region;
+
+  if (max_size == 0)
+    max_size = MAX_HEAP;
+  if ((region = (mem_region_t *)malloc(sizeof(mem_region_t))) == NULL)
+    return NULL;
+  if (mem_region_reserve(region, max_size) < 0) {
+    free(region);
+    return NULL;
+  }
+  return region;
+}
+
+/*
+ * mem_region_destroy - release a region made by mem_region_create,
+ *    along with everything in it
+ */
+void mem_region_destroy(mem_region_t *region) {
+  munmap(region->start_brk, region->max_addr - region->start_brk);
+  free(region);
+}
+
+/* 
+ * mem_region_sbrk - mem_sbrk for any region. Growing commits the pages
+ *    the heap moves into; shrinking gives back every page the heap no
+ *    longer touches.
+ */
+void *mem_region_sbrk(mem_region_t *region, intptr_t incr) {
+  char *old_brk = region->brk;
+  char *new_brk = region->brk + incr;
+  size_t pagesize = mem_pagesize();
+
+  if ( (incr < 0 && -incr > region->brk - region->start_brk) ||
+       (incr > 0 && incr > region->max_addr - region->brk) ) {
+    errno = ENOMEM;
+    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+    return (void *)-1;
+  }
+
+  if (new_brk > region->commit_brk) {
+    /* commit up to the next chunk boundary past the new brk */
+    size_t offset = new_brk - region->start_brk;
+    char *commit = region->start_brk +
+      (offset + MEM_COMMIT_CHUNK - 1) / MEM_COMMIT_CHUNK * MEM_COMMIT_CHUNK;
+    if (commit > region->max_addr)
+      commit = region->max_addr;
+    if (mprotect(region->commit_brk, commit - region->commit_brk,
+		 PROT_READ | PROT_WRITE) < 0) {
+      fprintf(stderr, "ERROR: mem_sbrk failed. mprotect: %s\n",
+	      strerror(errno));
+      return (void *)-1;
+    }
+    region->commit_brk = commit;
+  }
+  else if (incr < 0) {
+    /* drop every dirty page past the new brk (after a mem_reset_brk
+       there can be dirty pages above the old brk as well) */
+    char *lo = region->start_brk +
+      (new_brk - region->start_brk + pagesize - 1) / pagesize * pagesize;
+    char *hi = region->start_brk +
+      (region->dirty_brk - region->start_brk + pagesize - 1) / pagesize * pagesize;
+    if (hi > lo) {
+      madvise(lo, hi - lo, MADV_DONTNEED);
+      /* those pages read back as zero now */
+      region->dirty_brk = lo;
+    }
+  }
+
+  region->brk = new_brk;
+  if (new_brk > region->peak_brk)
+    region->peak_brk = new_brk;
+  if (new_brk > region->dirty_brk)
+    region->dirty_brk = new_brk;
+  if (region == &mem_heap)
+    mem_update_peak();
+  return (void *)old_brk;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of a region
+ */
+void *mem_region_lo(mem_region_t *region) {
+  return (void *)region->start_brk;
+}
+
+/* 
+ * mem_region_hi - return address of the last byte of a region
+ */
+void *mem_region_hi(mem_region_t *region) {
+  return (void *)(region->brk - 1);
+}
+
+/*
+ * mem_region_size - returns the size of a region in bytes
+ */
+size_t mem_region_size(mem_region_t *region) {
+  return (size_t)(region->brk - region->start_brk);
+}
+
+/*
+ * mem_region_peak - returns the largest a region has been, in bytes
+ */
+size_t mem_region_peak(mem_region_t *region) {
+  return (size_t)(region->peak_brk - region->start_brk);
+}
+
+/*
+ * mem_region_dirty_end - returns a region's dirty watermark
+ */
+void *mem_region_dirty_end(mem_region_t *region) {
+  return (void *)region->dirty_brk;
+}
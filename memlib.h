@@ -1,11 +1,39 @@
 #include <unistd.h>
 
+/* A region is one simulated heap with its own brk pointer */
+typedef struct mem_region {
+  char *start_brk;  /* points to first byte of heap */
+  char *brk;        /* points to last byte of heap */
+  char *commit_brk; /* end of the pages made accessible so far */
+  char *peak_brk;   /* highest brk since the heap was last reset */
+  char *dirty_brk;  /* every byte from here up is still zero */
+  char *max_addr;   /* largest legal heap address */
+} mem_region_t;
+
 void mem_init(void);
 void mem_deinit(void);
-void *mem_sbrk(size_t incr);
+void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heap_peak(void);
+void *mem_heap_dirty_end(void);
 size_t mem_pagesize(void);
 
+/* Mappings outside the heap, for blocks too big for it */
+void *mem_map(size_t size);
+void mem_unmap(void *start);
+void *mem_remap(void *start, size_t size);
+int mem_in_mapping(void *lo, void *hi);
+
+/* Additional heaps besides the one mem_init sets up */
+mem_region_t *mem_default_region(void);
+mem_region_t *mem_region_create(size_t max_size);
+void mem_region_destroy(mem_region_t *region);
+void *mem_region_sbrk(mem_region_t *region, intptr_t incr);
+void *mem_region_lo(mem_region_t *region);
+void *mem_region_hi(mem_region_t *region);
+size_t mem_region_size(mem_region_t *region);
+size_t mem_region_peak(mem_region_t *region);
+void *mem_region_dirty_end(mem_region_t *region);
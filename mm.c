@@ -36,6 +36,11 @@
 #include <assert.h>
 #include <unistd.h>
 #include <math.h>
+#include <string.h>
+#include <errno.h>
+#ifdef MM_THREAD_SAFE
+#include <pthread.h>
+#endif
 // This file provides the memory management functions we need for our implementation
 #include "memlib.h"
 // This file just contains some function declarations
@@ -43,15 +48,15 @@
 
 /**
  * This is a hard-coded heap, use it to debug the initial set of functions before starting the malloc implementation
- * It contains 3 blocks:
+ * It contains 3 blocks (sizes include the 8-byte header, free blocks end in a footer):
  *   - 64B free block
- *   - 32B allocated block
+ *   - 32B allocated block, previous block free
  *   - 32B free block
  */
-static long fake_heap[22] = {
-    -64, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    32, (unsigned long)(&fake_heap), 1, 1, 1, 1,
-    -32, (unsigned long)(&fake_heap[10]), 2, 2, 2, 2
+static long fake_heap[16] = {
+    64, (unsigned long)(&fake_heap[12]), 0, 0, 0, 0, 0, 64,
+    32 | 0x1 | 0x2, 1, 1, 1,
+    32, 0, (unsigned long)(&fake_heap), 32
 };
 
 
@@ -68,40 +73,335 @@ static long fake_heap[22] = {
 #define UNSCALED_POINTER_SUB(p, x) ((void *)((char *)(p) - (x)))
 
 
-typedef struct _BlockInfo
+/* Alignment of blocks returned by mm_malloc.
+ * (We need each allocation to at least be big enough for the free space
+ * metadata... so let's just align by that.)
+ * Compact links are only 8 bytes, but payloads stay 16-byte aligned. */
+#ifdef MM_COMPACT_HEADERS
+#define ALIGNMENT 16
+#else
+#define ALIGNMENT (sizeof(FreeBlockInfo_t))
+#endif
+
+/* Two-Level Segregated Fit (TLSF) free list index.
+ * The first level splits sizes by powers of two, the second level splits
+ * each power of two into SL_COUNT equal ranges. Sizes below
+ * SMALL_BLOCK_SIZE all live in first level 0, one 16-byte size per list.
+ * A bit is set in fl_bitmap/sl_bitmap for every non-empty list, so finding
+ * a non-empty list is a couple of find-first-set instructions. */
+#define SL_INDEX_SHIFT 3
+#define SL_COUNT (1 << SL_INDEX_SHIFT)
+#define FL_INDEX_SHIFT (SL_INDEX_SHIFT + 4)
+#define SMALL_BLOCK_SIZE (1UL << FL_INDEX_SHIFT)
+#define FL_INDEX_MAX 39
+#define FL_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 2)
+#define NUM_SIZE_CLASSES (FL_COUNT * SL_COUNT)
+
+/* Placement policy, i.e. which block of a size class a search picks and
+ * how each class's list is ordered. Every policy finds its size class
+ * through the same bitmaps and shares split/coalesce:
+ *   FIT_LIFO    - lists are LIFO, take the head of the first class that is
+ *                 sure to fit (TLSF good fit); fastest
+ *   FIT_ADDRESS - lists are kept in address order, first fit in the
+ *                 request's own class, otherwise the lowest block of the
+ *                 next class; packs blocks towards the bottom of the heap
+ *   FIT_NEXT    - LIFO lists, first fit in the request's own class starting
+ *                 where the last search there stopped (the rover)
+ *   FIT_BEST    - LIFO lists, the smallest of the first
+ *                 MM_BEST_FIT_CANDIDATES blocks that fit
+ * FIT_BEST is the default: on the driver traces it packs random-bal and
+ * random2-bal a little tighter than the rest and costs no measurable
+ * throughput. Build with -DMM_FIT_POLICY=FIT_LIFO etc. to pick another. */
+#define FIT_LIFO    0
+#define FIT_ADDRESS 1
+#define FIT_NEXT    2
+#define FIT_BEST    3
+#ifndef MM_FIT_POLICY
+#define MM_FIT_POLICY FIT_BEST
+#endif
+#ifndef MM_BEST_FIT_CANDIDATES
+#define MM_BEST_FIT_CANDIDATES 8
+#endif
+
+/* Free blocks of at least MM_TREE_CUTOFF bytes don't go on the lists but
+ * into one tree ordered by (size, address), a treap: a binary search tree
+ * on that key that is also a heap on a priority hashed from the block's
+ * address, which keeps it balanced in expectation without storing
+ * anything but the two child links (treeNode, in place of freeNode).
+ * A search is then an exact best fit in O(log n), however many large
+ * free blocks there are. The lists stay as fast or faster up to 64 KB
+ * (a tree walk costs more than a short list scan), so only blocks past
+ * that go into the tree. */
+#ifndef MM_TREE_CUTOFF
+#define MM_TREE_CUTOFF (64 * 1024)
+#endif
+
+/* Small objects (slabs).
+ * Requests of up to SLAB_MAX_SIZE bytes don't get a block of their own.
+ * They come out of slabs: SLAB_SIZE-aligned runs of the heap (carved out
+ * as ordinary allocated blocks) that are cut into equal slots of one size
+ * class. The Slab_t metadata sits at the start of the run, so it is found
+ * by masking an object's address, and a bitmap in it tracks which slots
+ * are in use. slab_map has one bit per SLAB_SIZE page of the first
+ * MM_SLAB_SPAN bytes of the heap (or of the whole region, if that is
+ * smaller), set when that page is a slab; slabs are only made inside that
+ * span, and once it is used up small objects come out of the heap like
+ * any other until a slab is given back. The main arena's map is static,
+ * another arena's sits in its region right after its malloc_info_t.
+ * 2KB slabs measured best on the driver traces: bigger ones sit mostly
+ * empty on small heaps (bdd-aa4), smaller ones spend too much on metadata. */
+#define SLAB_SHIFT 11
+#define SLAB_SIZE (1UL << SLAB_SHIFT)
+#define SLAB_MAX_SIZE 128
+#define NUM_SLAB_CLASSES (SLAB_MAX_SIZE / ALIGNMENT)
+#ifndef MM_SLAB_SPAN
+#define MM_SLAB_SPAN (1UL << 30)
+#endif
+#define SLAB_MAP_BITS (8 * sizeof(unsigned long))
+#define SLAB_MAP_WORDS (MM_SLAB_SPAN / SLAB_SIZE / SLAB_MAP_BITS)
+
+/* Empty slabs we hold on to (for any size class) before giving them back
+ * to the heap; carving a fresh aligned slab is the expensive part. */
+#ifndef MM_EMPTY_SLABS
+#define MM_EMPTY_SLABS 4
+#endif
+
+/* Quick lists: freed heap blocks of up to QUICK_MAX_SIZE bytes are not
+ * coalesced right away but parked on a list for their size, still
+ * marked allocated, so a malloc of the same size right after takes them
+ * back without a merge and a split. (mm_free_sized files a block by the
+ * size it was asked for, which can be a bit less than its own.)
+ * A list holds up to MM_QUICK_COUNT
+ * blocks; when it overflows it is coalesced as a batch, and all of them
+ * are before the heap has to grow. -DMM_QUICK_COUNT=0 turns this off. */
+#define QUICK_MAX_SIZE 1024
+#define QUICK_BINS (QUICK_MAX_SIZE / ALIGNMENT)
+#ifndef MM_QUICK_COUNT
+#define MM_QUICK_COUNT 8
+#endif
+
+typedef struct mm_arena
 {
-    long int size;          // Size of block
-    struct _Block *prev;    // Explicit pointer to previous Block
-} BlockInfo_t;
+    mem_region_t *region;       // memlib region the heap lives in
+    char *heap_start;           // First byte of the heap within region
+    Block_t *malloc_list_tail;  // Use keep track of the tail node
+    unsigned long fl_bitmap;                // Bit fl is set if any list in first level fl is non-empty
+    unsigned long sl_bitmap[FL_COUNT];      // Bit sl is set if list (fl, sl) is non-empty
+    Block_t *free_lists[NUM_SIZE_CLASSES];  // Segregated free lists, one list per (fl, sl) pair (stage 3)
+    Block_t *rover;                         // Next fit: the block the last list search stopped at
+    block_ref_t free_tree;                  // Root of the free blocks of at least MM_TREE_CUTOFF bytes
+    Slab_t *slabs[NUM_SLAB_CLASSES];        // Slabs with at least one free slot, one list per small size class
+    Slab_t *empty_slabs;                    // Cache of empty slabs, linked through nextSlab
+    int num_empty_slabs;                    // Number of slabs in empty_slabs
+    unsigned long *slab_map;                // Bit set for every heap page that is a slab
+    unsigned long slab_map_words;           // Size of slab_map
+    unsigned long slab_map_used;            // Words of slab_map that may have a bit set
+    int slabs_full;                         // No slab fits in the span slab_map covers
+    Block_t *quick_lists[QUICK_BINS];       // Freed but uncoalesced blocks, one LIFO list per block size
+    int quick_counts[QUICK_BINS];           // Number of blocks in each quick list
+    unsigned long quick_bitmap;             // Bit i is set if quick list i is non-empty
+#ifdef MM_THREAD_SAFE
+    void *remote_frees;                     // Chunks freed without the heap lock, see remote_free_push
+#endif
+} malloc_info_t;
+
+/* Slab page map of the main arena, big enough for all of MM_SLAB_SPAN */
+static unsigned long main_slab_map[SLAB_MAP_WORDS];
+
+/* The arena behind mm_malloc/mm_free/mm_realloc, in memlib's default region */
+static malloc_info_t main_arena = {
+    .fl_bitmap = 0,
+    .sl_bitmap = { 0 },
+    .free_lists = { NULL },
+    .rover = NULL,
+    .free_tree = 0,
+    .slabs = { NULL },
+    .empty_slabs = NULL,
+    .num_empty_slabs = 0,
+    .slab_map = main_slab_map,
+    .slab_map_words = SLAB_MAP_WORDS,
+    .slab_map_used = 0,
+    .slabs_full = 0,
+    .quick_lists = { NULL },
+    .quick_counts = { 0 },
+    .quick_bitmap = 0,
+    .malloc_list_tail = NULL,
+#ifdef MM_THREAD_SAFE
+    .remote_frees = NULL,
+#endif
+};
 
-typedef struct _FreeBlockInfo
+/* Variable to keep malloc information tidy: the arena everything below
+ * works on. It's main_arena except inside the mm_arena_* calls. */
+#ifdef MM_THREAD_SAFE
+static __thread malloc_info_t *malloc_info = &main_arena;
+#else
+static malloc_info_t *malloc_info = &main_arena;
+#endif
+
+/* Block header layout (boundary tags).
+ * info.size holds the whole block size (header included), which is always
+ * a multiple of ALIGNMENT, so its low bits are free for flags:
+ *   BLOCK_ALLOC - this block is allocated
+ *   PREV_FREE   - the block right before this one is free
+ *   MMAPPED     - this block has a memlib mapping to itself (see Huge blocks)
+ * Allocated blocks are just the header word and the payload. Free blocks
+ * also carry the free list links and repeat their size in a footer (the
+ * last word of the block), which is what lets the next block find them
+ * without a prev pointer. */
+#define BLOCK_ALLOC 0x1L
+#define PREV_FREE   0x2L
+#define MMAPPED     0x4L
+#define FLAG_MASK   (ALIGNMENT - 1)
+
+/* The heap grows by a multiple of this many bytes at a time, so that runs
+ * of small requests don't each cost a mem_sbrk call. Must be a multiple of
+ * ALIGNMENT; build with -DMM_GROW_CHUNK=<bytes> to tune it.
+ * memlib's mem_sbrk is little more than a pointer bump (it commits pages
+ * MEM_COMMIT_CHUNK bytes at a time), and on the driver traces every
+ * bigger chunk costs utilization (the leftover of a chunk is a small free
+ * block that good fit hands out first), so by default we don't round up.
+ * Raise it when the heap sits on a real sbrk/mmap. */
+#ifndef MM_GROW_CHUNK
+#define MM_GROW_CHUNK ALIGNMENT
+#endif
+
+/* Heap trimming on free: once a free leaves a free tail block of more
+ * than MM_TRIM_THRESHOLD + MM_TRIM_PAD bytes, the heap is shrunk so that
+ * MM_TRIM_PAD bytes of it are left. The pad is hysteresis: after a trim
+ * the heap has to grow by another MM_TRIM_THRESHOLD before it trims
+ * again, so a program freeing and mallocing around its peak doesn't give
+ * pages back and fault them in again on every cycle.
+ * Build with -DMM_TRIM_THRESHOLD=0 to only ever trim in mm_trim. */
+#ifndef MM_TRIM_THRESHOLD
+#define MM_TRIM_THRESHOLD (1024 * 1024)
+#endif
+#ifndef MM_TRIM_PAD
+#define MM_TRIM_PAD (1024 * 1024)
+#endif
+
+/* Smallest block we ever make: header, free list links and a footer */
+#define MIN_BLOCK_SIZE (sizeof(Block_t) + sizeof(tag_t))
+
+/* The heap starts with this much padding so that payloads (which come
+ * right after the header) are ALIGNMENT-aligned */
+#define HEAP_PADDING (ALIGNMENT - sizeof(BlockInfo_t))
+
+/* Biggest block size a header can hold; compact heaps stop at 4GB */
+#ifdef MM_COMPACT_HEADERS
+#define MAX_BLOCK_SIZE (0xFFFFFFFFUL & ~FLAG_MASK)
+#else
+#define MAX_BLOCK_SIZE (0x7FFFFFFFFFFFFFFFUL & ~FLAG_MASK)
+#endif
+
+/* The header word of a block. In the thread-safe build mm_free reads
+ * the header of the block it is handed without the heap lock (see
+ * tcache_chunk_bin), while the lock holder may be setting PREV_FREE in
+ * that very word as it frees the block in front, so every access is a
+ * relaxed atomic: a plain load or store, but not a data race. */
+static inline tag_t header_load(Block_t *block)
 {
-    struct _Block *nextFree;    // Explicit pointer to next free Block (stage 3)
-    struct _Block *prevFree;    // Explicit pointer to previous free Block (stage 3)
-} FreeBlockInfo_t;
+    return __atomic_load_n(&block->info.size, __ATOMIC_RELAXED);
+}
 
-typedef struct _Block
+static inline void header_store(Block_t *block, tag_t value)
 {
-    BlockInfo_t info;           // Composing both infos into a single struct
-    FreeBlockInfo_t freeNode;   //  Think: What does this mean in terms of memory?
-} Block_t;
+    __atomic_store_n(&block->info.size, value, __ATOMIC_RELAXED);
+}
 
-typedef struct
+/* Size of the block in bytes, header included */
+static inline size_t block_size(Block_t *block)
 {
-    Block_t *malloc_list_tail;  // Use keep track of the tail node
-    Block_t *free_list_head;    // Pointer to the first FreeBlockInfo_t in the free list, use in stage 3.
-} malloc_info_t;
+    return header_load(block) & ~FLAG_MASK;
+}
 
-/* Variable to keep malloc information tidy */
-static malloc_info_t malloc_info = {
-    .free_list_head = NULL,
-    .malloc_list_tail = NULL,
-};
+/* Is the block free? */
+static inline int is_free(Block_t *block)
+{
+    return !(header_load(block) & BLOCK_ALLOC);
+}
 
-/* Alignment of blocks returned by mm_malloc.
- * (We need each allocation to at least be big enough for the free space
- * metadata... so let's just align by that.)    */
-#define ALIGNMENT (sizeof(FreeBlockInfo_t))
+/* Does the block live in a mapping of its own instead of the heap? */
+static inline int is_mmapped(Block_t *block)
+{
+    return header_load(block) & MMAPPED;
+}
+
+/* The footer of a free block, its last word */
+static inline tag_t *block_footer(Block_t *block)
+{
+    return (tag_t *)UNSCALED_POINTER_ADD(block, block_size(block) - sizeof(tag_t));
+}
+
+/* A free list or free tree link to block, and the block a link points at */
+static inline block_ref_t block_ref(Block_t *block)
+{
+#ifdef MM_COMPACT_HEADERS
+    return block ? (char *)block - malloc_info->heap_start : 0;
+#else
+    return block;
+#endif
+}
+
+static inline Block_t *ref_block(block_ref_t ref)
+{
+#ifdef MM_COMPACT_HEADERS
+    return ref ? (Block_t *)(malloc_info->heap_start + ref) : NULL;
+#else
+    return ref;
+#endif
+}
+
+/* Payload address handed to the user for block, and back */
+static inline void *block_payload(Block_t *block)
+{
+    return UNSCALED_POINTER_ADD(block, sizeof(BlockInfo_t));
+}
+
+static inline Block_t *payload_block(void *ptr)
+{
+    return (Block_t *)UNSCALED_POINTER_SUB(ptr, sizeof(BlockInfo_t));
+}
+
+/* Smallest block size that can hold size bytes of payload */
+static inline size_t request_block_size(size_t size)
+{
+    size_t request_size = ALIGNMENT * ((size + sizeof(BlockInfo_t) + ALIGNMENT - 1) / ALIGNMENT);
+    return request_size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : request_size;
+}
+
+Block_t *next_block(Block_t *block);
+
+/* Mark block allocated with the given size, and tell the next block */
+static inline void set_allocated(Block_t *block, size_t size)
+{
+    header_store(block, size | BLOCK_ALLOC | (header_load(block) & PREV_FREE));
+
+    Block_t *next = next_block(block);
+    if(next){
+        header_store(next, header_load(next) & ~PREV_FREE);
+    }
+}
+
+/* Mark block free with the given size, write its footer, and tell the next block */
+static inline void set_free(Block_t *block, size_t size)
+{
+    header_store(block, size | (header_load(block) & PREV_FREE));
+    *block_footer(block) = size;
+
+    Block_t *next = next_block(block);
+    if(next){
+        header_store(next, header_load(next) | PREV_FREE);
+    }
+}
+
+/* The block right before block, found through its footer.
+ * Only valid when that block is free (PREV_FREE is set). */
+static inline Block_t *prev_free_block(Block_t *block)
+{
+    size_t prevSize = *(tag_t *)UNSCALED_POINTER_SUB(block, sizeof(tag_t));
+    return (Block_t *)UNSCALED_POINTER_SUB(block, prevSize);
+}
 
 
 /************************************************************************
@@ -123,10 +423,11 @@ size_t heap_size();
 Block_t *first_block()
 {
 
-    if(heap_size() == 0){
+    //the heap starts with HEAP_PADDING bytes, blocks come after that
+    if(heap_size() <= HEAP_PADDING){
         return NULL;
     }
-    Block_t *first = (Block_t*)(mem_heap_lo());
+    Block_t *first = (Block_t*)UNSCALED_POINTER_ADD(malloc_info->heap_start, HEAP_PADDING);
     
     return first;
 }
@@ -143,13 +444,10 @@ Block_t *next_block(Block_t *block)
         return NULL;
     }
 
-    //absolute value of data size
-    int x = abs(block->info.size);
-    
-    //next = base address + metadata + size of the data
-    Block_t *next = (Block_t*)UNSCALED_POINTER_ADD((block), (sizeof(BlockInfo_t) + x));
+    //next = base address + size of the whole block
+    Block_t *next = (Block_t*)UNSCALED_POINTER_ADD(block, block_size(block));
 	
-	if ((char*)next >= (char*)mem_heap_hi()){
+	if ((char*)next > (char*)mem_region_hi(malloc_info->region)){
 
 		//printf("END OF HEAP");
 		return NULL;
@@ -162,18 +460,21 @@ Block_t *next_block(Block_t *block)
  *
  * It returns a pointer to that new space. That pointer will always be
  * larger than the last request and be continuous in memory.
+ * Returns NULL if the region is out of room (an arena at its max_size).
  */
 void *request_more_space(size_t request_size)
 {    
-    //increase heap size by the requested amount and point at new heap space
-    void *ret = (Block_t*)(mem_sbrk(request_size)); 
+    //increase heap size by the requested amount and point at new heap space,
+    //as long as every offset in it still fits in a header
+    void *ret = (void *)-1;
+    if(request_size <= MAX_BLOCK_SIZE - heap_size()){
+        ret = (Block_t*)(mem_region_sbrk(malloc_info->region, request_size));
+    }
 
     //return type of a failed call to mem_sbrk
     if (ret == (void*)-1)
     {
-        // Let the program crash if you run out of memory!
-        printf("ERROR: failed to request_more_space\n");
-        exit(0);
+        return NULL;
     }
     return ret;
 }
@@ -181,7 +482,7 @@ void *request_more_space(size_t request_size)
 /* Returns the size of the heap */
 size_t heap_size()
 {
-    size_t size = mem_heapsize();
+    size_t size = (char *)mem_region_hi(malloc_info->region) + 1 - malloc_info->heap_start;
     return size;
 }
 
@@ -202,13 +503,8 @@ Block_t *search_list(size_t request_size)
     //if ptr_free_block is still traversing the heap
     while(ptr_free_block != NULL){
 
-        //size of ptr_free_block data
-        long int dataSize = ptr_free_block->info.size;
-        //absolute value of size of data
-        long int absSize = abs(dataSize);
-
         //if we have a free block && request_size < the size of the free block
-        if(dataSize < 0 && (request_size <= absSize)){
+        if(is_free(ptr_free_block) && (request_size <= block_size(ptr_free_block))){
 
             //we have found a free block with enough space
             return ptr_free_block;
@@ -225,374 +521,1891 @@ Block_t *search_list(size_t request_size)
 }
 
 /******************************* Stage 2 ********************************/
-/* Shrink block to size, and create a new block with remaining space. */
+/* Shrink block to size, and create a new block with remaining space.
+ * The block can be free (malloc) or allocated (realloc), it comes back
+ * allocated. The new block is free and on its free list.
+ * The caller makes sure the remaining space is at least MIN_BLOCK_SIZE. */
 void split(Block_t *block, size_t size) {
 
 	//full length of original block
-	//assert(block->info.size < 0);
-	long int ogSize = block->info.size;
+	size_t ogSize = block_size(block);
 
-    //remove the original big block
-    remove_free_node(block);
+    //remove the original big block (realloc also splits allocated blocks,
+    //those were never on a free list)
+    if(is_free(block)){
+        remove_free_node(block);
+    }
 
 	//shrunken block
-	block->info.size = size;
-
-	//new block allocated
-	Block_t* newBlock = (Block_t*)UNSCALED_POINTER_ADD(block, (size + sizeof(BlockInfo_t)));
+	set_allocated(block, size);
 
-	//new block info.size is being set
-	newBlock->info.size = -(abs(ogSize) - sizeof(BlockInfo_t) - size);
+	//new block right after it gets the rest
+	Block_t* newBlock = (Block_t*)UNSCALED_POINTER_ADD(block, size);
+	header_store(newBlock, 0);
+	set_free(newBlock, ogSize - size);
     insert_free_node(newBlock);
 
-	//ADJUSTING THE POINTERS
+	//newBlock is the last block in our list if block was
+	if(malloc_info->malloc_list_tail == block){
+	    malloc_info->malloc_list_tail = newBlock;
+	}
 
-	newBlock->info.prev = block;
+}
 
-	//someBlock is the block that was after the original block
-	Block_t* someBlock = next_block(newBlock);
+/* Cut the free block into n allocated blocks of size bytes each, one
+ * after the other, with a single free list update: what is left after
+ * them becomes one free block, or goes to the last of them if it's too
+ * small for that. The caller makes sure block holds at least n * size. */
+void carve(Block_t *block, size_t size, size_t n) {
 
+    size_t rest = block_size(block) - n * size;
+    Block_t *curr = block;
 
-	if(someBlock != NULL){
+    remove_free_node(block);
 
-	//someBlock.prev now points to newBlock
-	someBlock->info.prev = newBlock;
-	}
-	else{
-	    //newBlock is the last block in our list
-	    malloc_info.malloc_list_tail = newBlock;
-	}
-	//assert(next_block(block) == newBlock || next_block(block) == NULL);
-	    
+    //all but the last one get exactly size bytes
+    for(size_t i = 0; i < n - 1; i++){
+        set_allocated(curr, size);
+        curr = (Block_t*)UNSCALED_POINTER_ADD(curr, size);
+        header_store(curr, 0);
+    }
+
+    if(rest < MIN_BLOCK_SIZE){
+        set_allocated(curr, size + rest);
+        if(malloc_info->malloc_list_tail == block){
+            malloc_info->malloc_list_tail = curr;
+        }
+        return;
+    }
+    set_allocated(curr, size);
+
+    //the rest is a free block right after the last one
+    Block_t *newBlock = (Block_t*)UNSCALED_POINTER_ADD(curr, size);
+    header_store(newBlock, 0);
+    set_free(newBlock, rest);
+    insert_free_node(newBlock);
 
+    if(malloc_info->malloc_list_tail == block){
+        malloc_info->malloc_list_tail = newBlock;
+    }
 }
 
-/* Merge together consecutive free blocks. */
-void coalesce(Block_t *block) {
+/* Merge together consecutive free blocks. Returns the merged block. */
+Block_t *coalesce(Block_t *block) {
 
 
     //how much free data we have
-    long int freeData = abs(block->info.size);
+    size_t freeData = block_size(block);
 
-    Block_t *prevBlock = block->info.prev;
     Block_t *nextBlock = next_block(block);
 
-    //block is the only element in the list
-    // if(nextBlock == NULL && prevBlock == NULL){
-    //     return;
-    // }
-
     //the adjacent blocks are occupied or NULL
-    if((!nextBlock || nextBlock->info.size > 0 ) && (!prevBlock || prevBlock->info.size > 0)){
-        return;
+    if((!nextBlock || !is_free(nextBlock)) && !(header_load(block) & PREV_FREE)){
+        return block;
     }    
 
+    remove_free_node(block);
+
     //if there is a nextBlock and it's free
-    if(nextBlock && nextBlock->info.size < 0){
+    if(nextBlock && is_free(nextBlock)){
 
-        
         remove_free_node(nextBlock);
-        remove_free_node(block);
 
         //add nextBlock's info to freeData
-        freeData += (abs(nextBlock->info.size) + sizeof(BlockInfo_t));
+        freeData += block_size(nextBlock);
 
-        //if there is a block after nextBlock, we must point its prev to block
-        if(next_block(nextBlock)){
-
-            Block_t * nextNextBlock = next_block(nextBlock);
-            nextNextBlock->info.prev = block;
-
-        }
-        else{
-            //otherwise nextBlock was the last block, and now that we merge, block
-            //becomes the last block
-            malloc_info.malloc_list_tail = block;
+        //if nextBlock was the last block, now that we merge, block
+        //becomes the last block
+        if(malloc_info->malloc_list_tail == nextBlock){
+            malloc_info->malloc_list_tail = block;
         }
 
-
-        block->info.size = -freeData;
-
-        //bigger freeNode made up of nextBlock and block
-        insert_free_node(block);
-
     }
 
     //if there is a previous block and it's free
-    if(prevBlock && prevBlock->info.size < 0){
+    if(header_load(block) & PREV_FREE){
 
-        remove_free_node(block);
+        Block_t *prevBlock = prev_free_block(block);
         remove_free_node(prevBlock);
 
         //add prevBlock's info to freeData
-        freeData += (abs(prevBlock->info.size) + sizeof(BlockInfo_t));
-
-        //block now is located where prevBlock was
-        block = prevBlock;
-        block->info.size = -freeData;
+        freeData += block_size(prevBlock);
 
-        if(next_block(block)){
-           Block_t* nextNextBlock = next_block(block);
-           nextNextBlock->info.prev = block;
-        }
-        else{
-            malloc_info.malloc_list_tail = block;
+        if(malloc_info->malloc_list_tail == block){
+            malloc_info->malloc_list_tail = prevBlock;
         }
 
-        insert_free_node(block);
- 
+        //block now is located where prevBlock was
+        block = prevBlock;
 
     }
 
-    
-    
+    //bigger free block made up of all of them
+    set_free(block, freeData);
+    insert_free_node(block);
+
+    return block;
 
 }
 
-/******************************* Stage 3 ********************************/
-/* Insert free block into the free_list.
- */
-void insert_free_node(Block_t *block){
+/* Grow the heap so that its last block is a free block of at least size
+ * bytes, and return that block (it is on its free list), or NULL if the
+ * heap can't grow that far.
+ * If the tail is already free we only ask for the shortfall and merge it
+ * into the tail; either way the request is rounded up to MM_GROW_CHUNK. */
+Block_t *extend_heap(size_t size)
+{
+    Block_t *tail = malloc_info->malloc_list_tail;
+    size_t grow = size;
 
-    if(block->info.size > 0){
-        return;
+    //a free tail already covers part of the request
+    if(tail && is_free(tail)){
+        grow -= block_size(tail) < size ? block_size(tail) : size;
     }
 
-    //INSERTING AT THE FRONT
-
+    //grow in whole chunks, at least one free block's worth
+    grow = MM_GROW_CHUNK * ((grow + MM_GROW_CHUNK - 1) / MM_GROW_CHUNK);
+    if(grow < MIN_BLOCK_SIZE){
+        grow = MIN_BLOCK_SIZE;
+    }
 
-    //block is the first element in the free list
-    if(!malloc_info.free_list_head){
-        malloc_info.free_list_head = block;
-        block->freeNode.nextFree = NULL;
-        block->freeNode.prevFree = NULL;
-        return;
+    Block_t *block = (Block_t*)(request_more_space(grow));
+    if(block == NULL){
+        return NULL;
     }
 
+    //the new space is a free block after the old tail...
+    header_store(block, (tail && is_free(tail)) ? PREV_FREE : 0);
+    set_free(block, grow);
+    insert_free_node(block);
+
+    //REMEMBER TO MOVE THE TAIL TO THE NEW TAIL SINCE WE CHANGED THE SIZE OF THE HEAP
+    malloc_info->malloc_list_tail = block;
 
-    //not the first element in the list
-    if(malloc_info.free_list_head){
-    
-        //temp = first block in list
-       Block_t* temp = malloc_info.free_list_head;
+    //...that merges into the old tail if that one was free
+    return coalesce(block);
+}
 
-       //first block in list changed to block
-       malloc_info.free_list_head = block;
+/* Shrink the heap so that a free tail block keeps only pad bytes (at
+ * least a minimal block), giving the rest back to memlib.
+ * Returns 1 if the heap got smaller, 0 otherwise. */
+int heap_trim(size_t pad)
+{
+    Block_t *tail = malloc_info->malloc_list_tail;
+    if(tail == NULL || !is_free(tail)){
+        return 0;
+    }
 
-       //next free Block is temp
-       block->freeNode.nextFree = temp;
-       //there's no block before the first free
-       block->freeNode.prevFree = NULL;
-       //block before temp is the new firstNode
-       temp->freeNode.prevFree = block;
-       
+    size_t keep = (pad + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if(keep < MIN_BLOCK_SIZE){
+        keep = MIN_BLOCK_SIZE;
+    }
+    size_t size = block_size(tail);
+    if(size <= keep){
+        return 0;
     }
 
+    //cut the tail down to keep bytes; it stays the tail and stays free
+    remove_free_node(tail);
+    mem_region_sbrk(malloc_info->region, -(intptr_t)(size - keep));
+    set_free(tail, keep);
+    insert_free_node(tail);
+    return 1;
 }
 
-/* Remove free block from the free_list.
- */
-void remove_free_node(Block_t *block) {
-
-    //what do we do if block is the only block
-    if(malloc_info.free_list_head == block && block->freeNode.nextFree == NULL){
+/* Allocate a block of request_size bytes whose payload is aligned to
+ * alignment (a power of two, at least ALIGNMENT), and return it.
+ * The block is carved out of a free block big enough to hold the slack:
+ * the bytes in front of the aligned payload stay behind as a free block
+ * and whatever is left after it is split off as usual.
+ * Returns NULL if the heap can't grow enough for it. */
+Block_t *alloc_aligned_block(size_t alignment, size_t request_size)
+{
+    //worst case we skip almost alignment bytes plus a whole free block in front
+    size_t search_size = request_size + alignment + MIN_BLOCK_SIZE;
 
-        malloc_info.free_list_head = NULL;
-        return;
+    Block_t *block = search_free_list(search_size);
+    if(block == NULL && quick_flush()){
+        block = search_free_list(search_size);
+    }
+    if(block == NULL){
+        //grow the heap by just enough to fit the aligned block at its end:
+        //the new space starts at the free tail (if any) or the old brk
+        Block_t *tail = malloc_info->malloc_list_tail;
+        char *start = (char *)UNSCALED_POINTER_ADD(mem_region_hi(malloc_info->region), 1);
+        if(tail && is_free(tail)){
+            start = (char *)tail;
+        }
+        char *payload = start + sizeof(BlockInfo_t);
+        char *aligned = (char *)(((unsigned long)payload + alignment - 1) & ~(alignment - 1));
+        while(aligned != payload && (size_t)(aligned - payload) < MIN_BLOCK_SIZE){
+            aligned += alignment;
+        }
+        block = extend_heap((aligned - payload) + request_size);
+        if(block == NULL){
+            return NULL;
+        }
     }
 
-    //what do we do if it's the first block
-    if(malloc_info.free_list_head == block){
-
-        //head of malloc is now the block that was after block
-        malloc_info.free_list_head = block->freeNode.nextFree;
-        //new head.prev is set to NULL
-        malloc_info.free_list_head->freeNode.prevFree = NULL;
-        
-        return;
-        
+    //first aligned payload that leaves either nothing or a whole free block in front
+    char *payload = (char *)block_payload(block);
+    char *aligned = (char *)(((unsigned long)payload + alignment - 1) & ~(alignment - 1));
+    while(aligned != payload && (size_t)(aligned - payload) < MIN_BLOCK_SIZE){
+        aligned += alignment;
     }
-    //367 causing me issues
+    size_t lead = aligned - payload;
+    size_t total = block_size(block);
 
-    //what do we do if block is the last block
-    if(block->freeNode.nextFree == NULL){
+    remove_free_node(block);
 
-        Block_t* prevBlock = block->freeNode.prevFree;
-        prevBlock->freeNode.nextFree = NULL;
+    if(lead){
+        //the front stays a (smaller) free block...
+        set_free(block, lead);
+        insert_free_node(block);
 
-        //block->freeNode.prevFree->freeNode.nextFree == NULL;
+        //...and ours starts right after it
+        Block_t *alignedBlock = (Block_t *)UNSCALED_POINTER_ADD(block, lead);
+        header_store(alignedBlock, PREV_FREE);
+        set_allocated(alignedBlock, total - lead);
 
-        return;
+        if(malloc_info->malloc_list_tail == block){
+            malloc_info->malloc_list_tail = alignedBlock;
+        }
+        block = alignedBlock;
+    }
+    else{
+        set_allocated(block, total);
     }
 
-    //if its in the middle
-
-    Block_t *prevBlock = block->freeNode.prevFree;
-    Block_t *nextBlock = block->freeNode.nextFree;
+    //give back what we don't need at the end
+    if(block_size(block) - request_size >= MIN_BLOCK_SIZE){
+        split(block, request_size);
+    }
 
-    prevBlock->freeNode.nextFree = nextBlock;
-    nextBlock->freeNode.prevFree = prevBlock;
+    return block;
+}
 
+/******************************* Stage 3 ********************************/
+/* Map a block size to the index of the segregated free list that holds it,
+ * fl * SL_COUNT + sl in TLSF terms.
+ */
+int size_class(size_t size)
+{
+    //small blocks: one list per ALIGNMENT step
+    if(size < SMALL_BLOCK_SIZE){
+        return size / (SMALL_BLOCK_SIZE / SL_COUNT);
+    }
 
-    block->freeNode.prevFree = NULL;
-    block->freeNode.nextFree = NULL;
+    //floor(log2(size)), size is never 0 here
+    int log2_size = (int)(sizeof(long) * 8 - 1) - __builtin_clzl(size);
 
-    
+    //sizes past the top of the index all share the very last list
+    if(log2_size > FL_INDEX_MAX){
+        return NUM_SIZE_CLASSES - 1;
+    }
 
+    //the SL_INDEX_SHIFT bits right below the leading one pick the second level
+    int fl = log2_size - (FL_INDEX_SHIFT - 1);
+    int sl = (size >> (log2_size - SL_INDEX_SHIFT)) ^ SL_COUNT;
+    return fl * SL_COUNT + sl;
 }
 
-/* Find a free block of at least the requested size in the free list.
-    Returns NULL if no free block is large enough. */
-Block_t *search_free_list(size_t request_size)
+/* Does a before b in the free tree's (size, address) order? */
+static inline int tree_before(Block_t *a, Block_t *b)
 {
-    Block_t *ptr_free_block = malloc_info.free_list_head;
-    long int check_size = -request_size;
+    return block_size(a) < block_size(b) ||
+           (block_size(a) == block_size(b) && a < b);
+}
 
+/* Treap priority of a block, a multiplicative hash of its address */
+static inline unsigned long tree_priority(Block_t *block)
+{
+    return ((unsigned long)block >> 4) * 0x9E3779B97F4A7C15UL;
+}
 
-    //while we are still travering our free list
-    while(ptr_free_block){
+/* Add a free block to the free tree. */
+static void tree_insert(Block_t *block)
+{
+    //go down until block's priority beats the subtree's root...
+    block_ref_t *link = &malloc_info->free_tree;
+    while(*link && tree_priority(ref_block(*link)) > tree_priority(block)){
+        Block_t *node = ref_block(*link);
+        link = tree_before(block, node) ? &node->treeNode.left : &node->treeNode.right;
+    }
 
-        //used 'less than' to compare negatives
-        if(ptr_free_block->info.size <= check_size){
-            return ptr_free_block;
+    //...and split that subtree around block, which takes its place
+    Block_t *curr = ref_block(*link);
+    block_ref_t *left = &block->treeNode.left;
+    block_ref_t *right = &block->treeNode.right;
+    while(curr){
+        if(tree_before(curr, block)){
+            *left = block_ref(curr);
+            left = &curr->treeNode.right;
+            curr = ref_block(curr->treeNode.right);
+        }
+        else{
+            *right = block_ref(curr);
+            right = &curr->treeNode.left;
+            curr = ref_block(curr->treeNode.left);
         }
-        //go to the next block in the freeNode
-        ptr_free_block = ptr_free_block->freeNode.nextFree;
-
     }
-
-    return NULL;
+    *left = 0;
+    *right = 0;
+    *link = block_ref(block);
 }
 
-// TOP-LEVEL ALLOCATOR INTERFACE ------------------------------------
-
-/* Initialize the allocator. */
-int mm_init()
+/* Take a free block out of the free tree. */
+static void tree_remove(Block_t *block)
 {
-    // Modify this function only if you add variables that need to be initialized.
-    // This will be called ONCE at the beginning of execution
-    malloc_info.free_list_head = NULL;
-    malloc_info.malloc_list_tail = NULL;
-
+    //find the link that points at block...
+    block_ref_t *link = &malloc_info->free_tree;
+    while(ref_block(*link) != block){
+        Block_t *node = ref_block(*link);
+        link = tree_before(block, node) ? &node->treeNode.left : &node->treeNode.right;
+    }
 
-    return 0;
+    //...and merge its two subtrees in its place
+    Block_t *left = ref_block(block->treeNode.left);
+    Block_t *right = ref_block(block->treeNode.right);
+    while(left && right){
+        if(tree_priority(left) > tree_priority(right)){
+            *link = block_ref(left);
+            link = &left->treeNode.right;
+            left = ref_block(left->treeNode.right);
+        }
+        else{
+            *link = block_ref(right);
+            link = &right->treeNode.left;
+            right = ref_block(right->treeNode.left);
+        }
+    }
+    *link = block_ref(left ? left : right);
 }
 
-/* Allocate a block of size size and return a pointer to it. If size is zero,
- * returns null.
- */
-void *mm_malloc(size_t size)
+/* Smallest free block in the tree with at least request_size bytes (the
+ * lowest one of those if there are several), NULL if there is none. */
+static Block_t *tree_best_fit(size_t request_size)
 {
-    Block_t *ptr_free_block = NULL;
-
-    // Zero-size requests get NULL.
-    if (size == 0){
-        return NULL;
+    Block_t *best = NULL;
+    Block_t *curr = ref_block(malloc_info->free_tree);
+    while(curr){
+        if(block_size(curr) >= request_size){
+            best = curr;
+            curr = ref_block(curr->treeNode.left);
+        }
+        else{
+            curr = ref_block(curr->treeNode.right);
+        }
     }
+    return best;
+}
 
-    //examine_heap();
-    // Determine the amount of memory we want to allocate
-    // Round up for correct alignment
-    long int request_size = ALIGNMENT * ((size + ALIGNMENT - 1) / ALIGNMENT);
+/* Insert free block into the free list of its size class.
+ */
+void insert_free_node(Block_t *block){
 
-     //ptr_free_block = search_list(request_size);
-    ptr_free_block = search_free_list(request_size);
+    if(!is_free(block)){
+        return;
+    }
 
-    if(ptr_free_block){
-    
-        if (abs(ptr_free_block->info.size) > request_size + sizeof(BlockInfo_t)){
-            split(ptr_free_block, request_size);
-        }
-        else{
-            remove_free_node(ptr_free_block);
-            ptr_free_block->info.size = -ptr_free_block->info.size;
-            
-        }
-        return (Block_t*)UNSCALED_POINTER_ADD(ptr_free_block, sizeof(BlockInfo_t));
+    //big blocks go into the tree instead
+    if(block_size(block) >= MM_TREE_CUTOFF){
+        tree_insert(block);
+        return;
     }
 
+    int index = size_class(block_size(block));
+    Block_t **head = &malloc_info->free_lists[index];
 
+    if(*head == NULL){
+        //the list just became non-empty
+        malloc_info->fl_bitmap |= 1UL << (index / SL_COUNT);
+        malloc_info->sl_bitmap[index / SL_COUNT] |= 1UL << (index % SL_COUNT);
+    }
 
-    //EXTENDING THE SIZE OF THE HEAP
-    if(ptr_free_block==NULL){
-            
-    //we didn't find a block, we ask for the size of a block
-    ptr_free_block = (Block_t*)(request_more_space(request_size + sizeof(BlockInfo_t)));
+#if MM_FIT_POLICY == FIT_ADDRESS
+    //INSERTING IN ADDRESS ORDER: after the last block below this one
+    Block_t *prevBlock = NULL;
+    Block_t *nextBlock = *head;
+    while(nextBlock && nextBlock < block){
+        prevBlock = nextBlock;
+        nextBlock = ref_block(nextBlock->freeNode.nextFree);
+    }
+#else
+    //INSERTING AT THE FRONT OF THE BLOCK'S SIZE CLASS
+    Block_t *prevBlock = NULL;
+    Block_t *nextBlock = *head;
+#endif
 
-    //setting the size of the new block
-    ptr_free_block->info.size = request_size;
-    
-    //REMEMBER TO MOVE THE TAIL TO THE NEW TAIL SINCE WE CHANGED THE SIZE OF THE HEAP
-    if(malloc_info.malloc_list_tail != NULL){
+    block->freeNode.prevFree = block_ref(prevBlock);
+    block->freeNode.nextFree = block_ref(nextBlock);
 
-        //ptr.prev = old last block
-        ptr_free_block->info.prev = malloc_info.malloc_list_tail;
+    if(prevBlock){
+        prevBlock->freeNode.nextFree = block_ref(block);
     }
     else{
-        //first block in heap
-        ptr_free_block->info.prev = NULL;
+        *head = block;
+    }
+    if(nextBlock){
+        nextBlock->freeNode.prevFree = block_ref(block);
     }
 
-    //ptr_free_block becomes the new tail
-    malloc_info.malloc_list_tail = ptr_free_block;
+}
 
-    // base + metadata to enter the user accessable data
-    return (Block_t*)UNSCALED_POINTER_ADD(ptr_free_block, sizeof(BlockInfo_t));
+/* Remove free block from the free list of its size class.
+ */
+void remove_free_node(Block_t *block) {
 
+    if(block_size(block) >= MM_TREE_CUTOFF){
+        tree_remove(block);
+        block->treeNode.left = 0;
+        block->treeNode.right = 0;
+        return;
     }
-    
-    // This funciton will cost you performance, remove it if you are not debugging.
-    // #warning This is a reminder, don't use these function after you are done debugging!
-    // {
-    //     // This function prints the heap
-    //     examine_heap();
-    //     // This function checks some common issues with the heap
-        check_heap();
-    // }
 
-    return NULL;
+    Block_t *prevBlock = ref_block(block->freeNode.prevFree);
+    Block_t *nextBlock = ref_block(block->freeNode.nextFree);
+
+    //what do we do if it's the first block: the head of its class moves on
+    if(prevBlock == NULL){
+        int index = size_class(block_size(block));
+        malloc_info->free_lists[index] = nextBlock;
+
+        //the list just became empty, and maybe its whole first level too
+        if(nextBlock == NULL){
+            int fl = index / SL_COUNT;
+            malloc_info->sl_bitmap[fl] &= ~(1UL << (index % SL_COUNT));
+            if(malloc_info->sl_bitmap[fl] == 0){
+                malloc_info->fl_bitmap &= ~(1UL << fl);
+            }
+        }
+    }
+    else{
+        prevBlock->freeNode.nextFree = block_ref(nextBlock);
+    }
 
+    //anything but the last block has a successor to patch up
+    if(nextBlock){
+        nextBlock->freeNode.prevFree = block_ref(prevBlock);
+    }
 
-}
+    //next fit carries on from where the block was
+    if(malloc_info->rover == block){
+        malloc_info->rover = nextBlock;
+    }
 
-    
+    block->freeNode.prevFree = 0;
+    block->freeNode.nextFree = 0;
 
-/* Free the block referenced by ptr. */
-void mm_free(void *ptr)
+}
+
+/* Walk the list of size class index for a block of at least request_size
+ * bytes, picking one the way MM_FIT_POLICY says. NULL if none fits. */
+static Block_t *search_class(int index, size_t request_size)
 {
-    //fprintf(stderr, "%p\n", ptr);
-    //examine_heap();
-    Block_t *block = (Block_t *)UNSCALED_POINTER_SUB(ptr, sizeof(BlockInfo_t));
+    Block_t *head = malloc_info->free_lists[index];
 
-    if(block == NULL){
-        return;
+#if MM_FIT_POLICY == FIT_NEXT
+    //start at the rover if it's in this list...
+    Block_t *start = malloc_info->rover;
+    if(start == NULL || size_class(block_size(start)) != index){
+        start = head;
+    }
+    for(Block_t *curr = start; curr; curr = ref_block(curr->freeNode.nextFree)){
+        if(block_size(curr) >= request_size){
+            malloc_info->rover = curr;
+            return curr;
+        }
     }
+    //...and wrap around to it
+    for(Block_t *curr = head; curr != start; curr = ref_block(curr->freeNode.nextFree)){
+        if(block_size(curr) >= request_size){
+            malloc_info->rover = curr;
+            return curr;
+        }
+    }
+    return NULL;
+#elif MM_FIT_POLICY == FIT_BEST
+    //the smallest of the first few that fit, an exact fit ends the search
+    Block_t *best = NULL;
+    int candidates = 0;
+    for(Block_t *curr = head; curr && candidates < MM_BEST_FIT_CANDIDATES;
+        curr = ref_block(curr->freeNode.nextFree)){
+        if(block_size(curr) >= request_size){
+            if(best == NULL || block_size(curr) < block_size(best)){
+                best = curr;
+                if(block_size(best) == request_size){
+                    break;
+                }
+            }
+            candidates++;
+        }
+    }
+    return best;
+#else
+    //first fit, in LIFO or address order
+    for(Block_t *curr = head; curr; curr = ref_block(curr->freeNode.nextFree)){
+        if(block_size(curr) >= request_size){
+            return curr;
+        }
+    }
+    return NULL;
+#endif
+}
 
-    long int blockSize = block->info.size;
+/* Find a free block of at least the requested size in the free lists.
+    With FIT_LIFO this is TLSF's good fit: the request is rounded up to
+    the next list boundary so that every block of the first non-empty list
+    at or above it fits, which the bitmaps find in constant time without
+    walking. Only when that finds nothing (and the heap would have to grow)
+    do we walk the request's own list for a block that fits exactly.
+    The other policies walk the request's own list first (see
+    search_class) and only then fall back on the bitmaps.
+    Returns NULL if no free block is large enough. */
+Block_t *search_free_list(size_t request_size)
+{
+    //nothing on the lists is this big
+    if(request_size >= MM_TREE_CUTOFF){
+        return tree_best_fit(request_size);
+    }
 
+#if MM_FIT_POLICY != FIT_LIFO
+    //blocks in the request's own class may or may not fit
+    Block_t *own = search_class(size_class(request_size), request_size);
+    if(own){
+        return own;
+    }
+#endif
 
-    //checking if it's an occupied block
-    if (blockSize > 0){
+    size_t rounded_size = request_size;
 
-        //free the block
-        blockSize = -blockSize;
+    //round up to the start of the next second level range
+    if(request_size >= SMALL_BLOCK_SIZE){
+        int log2_size = (int)(sizeof(long) * 8 - 1) - __builtin_clzl(request_size);
+        rounded_size += (1UL << (log2_size - SL_INDEX_SHIFT)) - 1;
     }
 
-    block->freeNode.nextFree = NULL;
-    block->freeNode.prevFree = NULL;
+    int index = size_class(rounded_size);
+    int fl = index / SL_COUNT;
+    int sl = index % SL_COUNT;
 
-    
+    //rounding ran past the top of the index, nothing here can fit
+    if(index == NUM_SIZE_CLASSES - 1 && rounded_size >> (FL_INDEX_MAX + 1)){
+        return tree_best_fit(request_size);
+    }
 
-    block->info.size = blockSize;
+    //any non-empty list at or after sl in the same first level?
+    unsigned long sl_map = malloc_info->sl_bitmap[fl] & (~0UL << sl);
+    if(sl_map == 0){
+
+        //no, take the smallest non-empty first level above fl
+        unsigned long fl_map = malloc_info->fl_bitmap & (~0UL << (fl + 1));
+        if(fl_map == 0){
+#if MM_FIT_POLICY == FIT_LIFO
+            //the request's own list can still hold a block that fits,
+            //rounding skipped it
+            Block_t *own = search_class(size_class(request_size), request_size);
+            if(own){
+                return own;
+            }
+#endif
+            //last chance before the heap has to grow: the big blocks
+            return tree_best_fit(request_size);
+        }
+        fl = __builtin_ctzl(fl_map);
+        sl_map = malloc_info->sl_bitmap[fl];
+    }
+    sl = __builtin_ctzl(sl_map);
+
+#if MM_FIT_POLICY == FIT_BEST
+    //everything in this list fits, pick the best of the first few
+    return search_class(fl * SL_COUNT + sl, request_size);
+#else
+    return malloc_info->free_lists[fl * SL_COUNT + sl];
+#endif
+}
+
+/******************************* Slabs **********************************/
+/* Is ptr an object inside a slab? Looks only at the slab page map.
+ * mm_free asks without the heap lock while the lock holder may be
+ * marking another page in the same word, so the map is read and written
+ * with relaxed atomics (see header_load). */
+int is_slab_object(void *ptr)
+{
+    unsigned long base = (unsigned long)malloc_info->heap_start & ~(SLAB_SIZE - 1);
+    unsigned long page = ((unsigned long)ptr - base) >> SLAB_SHIFT;
+
+    if((char *)ptr < (char *)malloc_info->heap_start ||
+       page >= __atomic_load_n(&malloc_info->slab_map_used, __ATOMIC_RELAXED) * SLAB_MAP_BITS){
+        return 0;
+    }
+    return (__atomic_load_n(&malloc_info->slab_map[page / SLAB_MAP_BITS], __ATOMIC_RELAXED) >> (page % SLAB_MAP_BITS)) & 1;
+}
+
+/* Mark or unmark the heap page that starts at slab as a slab. */
+static void set_slab_page(Slab_t *slab, int isSlab)
+{
+    unsigned long base = (unsigned long)malloc_info->heap_start & ~(SLAB_SIZE - 1);
+    unsigned long page = ((unsigned long)slab - base) >> SLAB_SHIFT;
+    unsigned long word = page / SLAB_MAP_BITS;
+    unsigned long bit = 1UL << (page % SLAB_MAP_BITS);
+
+    //only the lock holder writes the map, so a load and a store will do
+    unsigned long map = malloc_info->slab_map[word];
+    if(isSlab){
+        __atomic_store_n(&malloc_info->slab_map[word], map | bit, __ATOMIC_RELAXED);
+        if(word >= malloc_info->slab_map_used){
+            __atomic_store_n(&malloc_info->slab_map_used, word + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else{
+        __atomic_store_n(&malloc_info->slab_map[word], map & ~bit, __ATOMIC_RELAXED);
+    }
+}
+
+/* The slab an object lives in: mask off the low bits of its address. */
+static inline Slab_t *object_slab(void *ptr)
+{
+    return (Slab_t *)((unsigned long)ptr & ~(SLAB_SIZE - 1));
+}
+
+/* Address of the first slot in a slab, right after its metadata */
+static inline char *slab_objects(Slab_t *slab)
+{
+    return (char *)UNSCALED_POINTER_ADD(slab, ALIGNMENT * ((sizeof(Slab_t) + ALIGNMENT - 1) / ALIGNMENT));
+}
+
+/* Unlink a slab from the list of slabs with free slots of its class. */
+static void remove_slab(Slab_t *slab)
+{
+    if(slab->prevSlab){
+        slab->prevSlab->nextSlab = slab->nextSlab;
+    }
+    else{
+        malloc_info->slabs[slab->objectSize / ALIGNMENT - 1] = slab->nextSlab;
+    }
+    if(slab->nextSlab){
+        slab->nextSlab->prevSlab = slab->prevSlab;
+    }
+    slab->nextSlab = NULL;
+    slab->prevSlab = NULL;
+}
+
+/* Push a slab on the front of the list of slabs with free slots of its class. */
+static void insert_slab(Slab_t *slab)
+{
+    Slab_t **head = &malloc_info->slabs[slab->objectSize / ALIGNMENT - 1];
+
+    slab->prevSlab = NULL;
+    slab->nextSlab = *head;
+    if(*head){
+        (*head)->prevSlab = slab;
+    }
+    *head = slab;
+}
+
+/* Get a new, empty slab for objects of objectSize bytes: a cached empty
+ * one if we have it, otherwise one carved out of the heap.
+ * Returns NULL if it would fall outside the part of the heap slab_map
+ * covers; slabs_full then stops us carving (and throwing back) another
+ * one on every miss until a slab goes back to the heap. */
+Slab_t *new_slab(size_t objectSize)
+{
+    Slab_t *slab = malloc_info->empty_slabs;
+
+    if(slab){
+        malloc_info->empty_slabs = slab->nextSlab;
+        malloc_info->num_empty_slabs--;
+    }
+    else if(malloc_info->slabs_full){
+        return NULL;
+    }
+    else{
+        //the block is exactly SLAB_SIZE bytes, so the header of whatever
+        //follows takes the last word of the page and slabs can sit back to back
+        Block_t *block = alloc_aligned_block(SLAB_SIZE, SLAB_SIZE);
+        if(block == NULL){
+            return NULL;
+        }
+        slab = (Slab_t *)block_payload(block);
+
+        unsigned long base = (unsigned long)malloc_info->heap_start & ~(SLAB_SIZE - 1);
+        if((((unsigned long)slab - base) >> SLAB_SHIFT) >= malloc_info->slab_map_words * SLAB_MAP_BITS){
+            heap_free(slab);
+            malloc_info->slabs_full = 1;
+            return NULL;
+        }
+    }
+
+    slab->objectSize = objectSize;
+    slab->numObjects = (SLAB_SIZE - sizeof(BlockInfo_t) - (slab_objects(slab) - (char *)slab)) / objectSize;
+    slab->numFree = slab->numObjects;
+    for(int i = 0; i < SLAB_MAP_SLOTS; i++){
+        slab->usedMap[i] = 0;
+    }
+    set_slab_page(slab, 1);
+    insert_slab(slab);
+
+    return slab;
+}
+
+/* Allocate a small object (size <= SLAB_MAX_SIZE) from a slab of its class.
+ * Returns NULL if no slab can be made for it. */
+void *slab_malloc(size_t size)
+{
+    //size classes are ALIGNMENT bytes apart
+    int index = (size + ALIGNMENT - 1) / ALIGNMENT - 1;
+
+    Slab_t *slab = malloc_info->slabs[index];
+    if(slab == NULL){
+        slab = new_slab((index + 1) * ALIGNMENT);
+        if(slab == NULL){
+            return NULL;
+        }
+    }
+
+    //find the first zero bit in the used map: that's our slot
+    int word = 0;
+    while(slab->usedMap[word] == ~0UL){
+        word++;
+    }
+    int slot = word * 8 * sizeof(unsigned long) + __builtin_ctzl(~slab->usedMap[word]);
+
+    slab->usedMap[word] |= 1UL << (slot % (8 * sizeof(unsigned long)));
+    slab->numFree--;
+
+    //a full slab leaves the list until something in it is freed
+    if(slab->numFree == 0){
+        remove_slab(slab);
+    }
+
+    return slab_objects(slab) + slot * slab->objectSize;
+}
+
+/* Free an object that lives in a slab: clear its bit. */
+void slab_free(void *ptr)
+{
+    Slab_t *slab = object_slab(ptr);
+    int slot = ((char *)ptr - slab_objects(slab)) / slab->objectSize;
+
+    slab->usedMap[slot / (8 * sizeof(unsigned long))] &= ~(1UL << (slot % (8 * sizeof(unsigned long))));
+
+    //a full slab has a free slot again
+    if(slab->numFree++ == 0){
+        insert_slab(slab);
+    }
+
+    //an empty slab goes to the empty cache (or back to the heap if that's
+    //full), unless it's the only one with room in its class, so alloc/free
+    //of one object doesn't churn slabs
+    if(slab->numFree == slab->numObjects &&
+       (slab->prevSlab || slab->nextSlab)){
+        remove_slab(slab);
+        if(malloc_info->num_empty_slabs < MM_EMPTY_SLABS){
+            slab->nextSlab = malloc_info->empty_slabs;
+            malloc_info->empty_slabs = slab;
+            malloc_info->num_empty_slabs++;
+        }
+        else{
+            set_slab_page(slab, 0);
+            heap_free(slab);
+            malloc_info->slabs_full = 0;
+        }
+    }
+}
+
+/***************************** Quick lists ******************************/
+/* Quick list of the blocks of block size size */
+static inline int quick_bin(size_t size)
+{
+    return size / ALIGNMENT - 1;
+}
+
+/* Park an allocated block on quick list bin, linked through its payload. */
+static inline void quick_push(int bin, Block_t *block)
+{
+    block->freeNode.nextFree = block_ref(malloc_info->quick_lists[bin]);
+    malloc_info->quick_lists[bin] = block;
+    malloc_info->quick_counts[bin]++;
+    malloc_info->quick_bitmap |= 1UL << bin;
+}
+
+/* Take the most recently parked block off quick list bin, NULL if empty. */
+static inline Block_t *quick_pop(int bin)
+{
+    Block_t *block = malloc_info->quick_lists[bin];
+    if(block){
+        malloc_info->quick_lists[bin] = ref_block(block->freeNode.nextFree);
+        if(--malloc_info->quick_counts[bin] == 0){
+            malloc_info->quick_bitmap &= ~(1UL << bin);
+        }
+    }
+    return block;
+}
+
+/* Really free a heap block: mark it free, file it and coalesce it, then
+ * give a free tail well past MM_TRIM_THRESHOLD back to memlib. */
+static void release_block(Block_t *block)
+{
+    //free the block: header, footer and the next block's PREV_FREE bit
+    set_free(block, block_size(block));
     insert_free_node(block);
 
+    // When you are ready... you will want to implement coalescing:
+    block = coalesce(block);
+
+    //a big free tail goes back to memlib, all but MM_TRIM_PAD bytes of it
+    if(MM_TRIM_THRESHOLD && block == malloc_info->malloc_list_tail &&
+       block_size(block) > MM_TRIM_THRESHOLD + MM_TRIM_PAD){
+        heap_trim(MM_TRIM_PAD);
+    }
+}
+
+/* Free and coalesce every block on quick list bin. */
+static void quick_flush_bin(int bin)
+{
+    Block_t *block;
+    while((block = quick_pop(bin))){
+        release_block(block);
+    }
+}
+
+/* Free and coalesce every parked block. Returns 1 if there were any. */
+int quick_flush()
+{
+    if(malloc_info->quick_bitmap == 0){
+        return 0;
+    }
+    while(malloc_info->quick_bitmap){
+        quick_flush_bin(__builtin_ctzl(malloc_info->quick_bitmap));
+    }
+    return 1;
+}
+
+/***************************** Huge blocks ******************************/
+
+/* Requests of at least MM_MMAP_THRESHOLD bytes skip the heap and get a
+ * memlib mapping of their own: HEAP_PADDING bytes, then an ordinary header
+ * (with MMAPPED set) and the payload, filling the mapping's whole pages.
+ * Freeing one unmaps it straight away instead of leaving a hole in the
+ * heap, and realloc resizes the mapping with mremap instead of copying.
+ * Only the main arena does this; an arena keeps everything in its region
+ * so destroying it stays O(1).
+ * Build with -DMM_MMAP_THRESHOLD=0 to keep every block in the heap. */
+#ifndef MM_MMAP_THRESHOLD
+#define MM_MMAP_THRESHOLD (128 * 1024)
+#endif
+
+/* Should a request of size bytes get its own mapping? */
+static inline int use_mmap(size_t size)
+{
+    return MM_MMAP_THRESHOLD && size >= MM_MMAP_THRESHOLD &&
+           malloc_info == &main_arena;
+}
+
+/* Bytes of mapping for a block with a size byte payload */
+static inline size_t mmap_length(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    return (HEAP_PADDING + sizeof(BlockInfo_t) + size + pagesize - 1) & ~(pagesize - 1);
+}
+
+/* Map a block for size bytes, return its payload (NULL if memlib can't). */
+static void *mmap_malloc(size_t size)
+{
+    size_t length = mmap_length(size);
+    if(length - HEAP_PADDING > MAX_BLOCK_SIZE){
+        return NULL;
+    }
+    void *start = mem_map(length);
+    if(start == NULL){
+        return NULL;
+    }
+    Block_t *block = (Block_t *)UNSCALED_POINTER_ADD(start, HEAP_PADDING);
+    header_store(block, (length - HEAP_PADDING) | MMAPPED | BLOCK_ALLOC);
+    return block_payload(block);
+}
+
+/* Unmap a mapped block. */
+static void mmap_free(Block_t *block)
+{
+    mem_unmap(UNSCALED_POINTER_SUB(block, HEAP_PADDING));
+}
+
+/* Resize a mapped block to size bytes, possibly moving it. Returns the new
+ * payload, or NULL (and the block is left alone) if memlib can't. */
+static void *mmap_realloc(Block_t *block, size_t size)
+{
+    size_t length = mmap_length(size);
+    if(length == block_size(block) + HEAP_PADDING){
+        return block_payload(block);
+    }
+    if(length - HEAP_PADDING > MAX_BLOCK_SIZE){
+        return NULL;
+    }
+    void *start = mem_remap(UNSCALED_POINTER_SUB(block, HEAP_PADDING), length);
+    if(start == NULL){
+        return NULL;
+    }
+    block = (Block_t *)UNSCALED_POINTER_ADD(start, HEAP_PADDING);
+    header_store(block, (length - HEAP_PADDING) | MMAPPED | BLOCK_ALLOC);
+    return block_payload(block);
+}
+
+/**************************** Central heap ******************************/
+/* Allocate a block of size size from the central heap and return a pointer
+ * to it. If size is zero, returns null. Caller holds the heap lock.
+ */
+void *heap_malloc(size_t size)
+{
+    Block_t *ptr_free_block = NULL;
+
+    // Zero-size requests get NULL.
+    if (size == 0){
+        return NULL;
+    }
+
+    //small objects come out of slabs, no header and no split
+    if (size <= SLAB_MAX_SIZE){
+        void *ptr = slab_malloc(size);
+        if (ptr){
+            return ptr;
+        }
+    }
+
+    //huge ones get a mapping of their own
+    if (use_mmap(size)){
+        return mmap_malloc(size);
+    }
+
     //examine_heap();
+    // Determine the amount of memory we want to allocate:
+    // header + payload, rounded up for correct alignment
+    size_t request_size = request_block_size(size);
+
+    //a block of just this size freed a moment ago?
+    if(request_size <= QUICK_MAX_SIZE){
+        Block_t *quick = quick_pop(quick_bin(request_size));
+        if(quick){
+            return block_payload(quick);
+        }
+    }
 
-    // You can change or remove the declarations above.
-    // They are included as minor hints.
+     //ptr_free_block = search_list(request_size);
+    ptr_free_block = search_free_list(request_size);
 
-    // When you are ready... you will want to implement coalescing:
-    coalesce(block);
+    //parked blocks may coalesce into one that fits
+    if(ptr_free_block == NULL && quick_flush()){
+        ptr_free_block = search_free_list(request_size);
+    }
+
+    //EXTENDING THE SIZE OF THE HEAP
+    //we didn't find a block, so grow the heap (or the free tail) until we have one
+    if(ptr_free_block == NULL){
+        ptr_free_block = extend_heap(request_size);
+        if(ptr_free_block == NULL){
+            return NULL;
+        }
+    }
+
+    if (block_size(ptr_free_block) - request_size >= MIN_BLOCK_SIZE){
+        split(ptr_free_block, request_size);
+    }
+    else{
+        remove_free_node(ptr_free_block);
+        set_allocated(ptr_free_block, block_size(ptr_free_block));
+        
+    }
+
+    // base + header to enter the user accessable data
+    return block_payload(ptr_free_block);
+
+    // This funciton will cost you performance, remove it if you are not debugging.
+    // #warning This is a reminder, don't use these function after you are done debugging!
+    // {
+    //     // This function prints the heap
+    //     examine_heap();
+    //     // This function checks some common issues with the heap
+    //     check_heap();
+    // }
+
+}
+
+    
+
+/* Allocate n blocks of size bytes each, storing their payloads in ptrs.
+ * Heap-sized ones are carved out of one free block (see carve), after
+ * taking what the quick list of that size has. Returns how many were
+ * allocated. Caller holds the heap lock. */
+size_t heap_malloc_batch(size_t size, size_t n, void **ptrs)
+{
+    size_t done = 0;
+
+    if(size == 0 || n == 0){
+        return 0;
+    }
+
+    //slab objects and huge blocks have no free block to share
+    if(size <= SLAB_MAX_SIZE || use_mmap(size)){
+        while(done < n && (ptrs[done] = heap_malloc(size))){
+            done++;
+        }
+        return done;
+    }
+
+    size_t request_size = request_block_size(size);
+
+    //blocks of just this size freed a moment ago go first
+    if(request_size <= QUICK_MAX_SIZE){
+        Block_t *quick;
+        while(done < n && (quick = quick_pop(quick_bin(request_size)))){
+            ptrs[done++] = block_payload(quick);
+        }
+    }
+    if(done == n){
+        return done;
+    }
+
+    //one free block for the rest of them
+    size_t count = n - done;
+    if(count > MAX_BLOCK_SIZE / request_size){
+        return done;
+    }
+    Block_t *block = search_free_list(count * request_size);
+    if(block == NULL && quick_flush()){
+        block = search_free_list(count * request_size);
+    }
+    if(block == NULL){
+        block = extend_heap(count * request_size);
+        if(block == NULL){
+            return done;
+        }
+    }
+    carve(block, request_size, count);
+
+    for(size_t i = 0; i < count; i++){
+        ptrs[done++] = block_payload(block);
+        block = next_block(block);
+    }
+    return done;
+}
+
+/* Allocate size bytes whose address is a multiple of alignment (a power
+ * of two). The aligned block is carved out of a free block, and the slack
+ * in front of it stays on the free lists (see alloc_aligned_block).
+ * Caller holds the heap lock. */
+void *heap_memalign(size_t alignment, size_t size)
+{
+    //every block is ALIGNMENT-aligned anyway
+    if(alignment <= ALIGNMENT){
+        return heap_malloc(size);
+    }
+    if(size == 0){
+        return NULL;
+    }
+    Block_t *block = alloc_aligned_block(alignment, request_block_size(size));
+    if(block == NULL){
+        return NULL;
+    }
+    return block_payload(block);
+}
+
+/* Free the block referenced by ptr back to the central heap.
+ * Caller holds the heap lock. */
+void heap_free(void *ptr)
+{
+    //fprintf(stderr, "%p\n", ptr);
+    //examine_heap();
+    if(ptr == NULL){
+        return;
+    }
+
+    //small objects just clear their bit in the slab
+    if(is_slab_object(ptr)){
+        slab_free(ptr);
+        return;
+    }
+
+    Block_t *block = payload_block(ptr);
+
+    //a huge block just goes away
+    if(is_mmapped(block)){
+        mmap_free(block);
+        return;
+    }
+
+    //a small one waits on its quick list, coalescing the list if it's full
+    if(block_size(block) <= QUICK_MAX_SIZE){
+        int bin = quick_bin(block_size(block));
+        if(malloc_info->quick_counts[bin] == MM_QUICK_COUNT){
+            quick_flush_bin(bin);
+        }
+        if(malloc_info->quick_counts[bin] < MM_QUICK_COUNT){
+            quick_push(bin, block);
+            return;
+        }
+    }
+
+    release_block(block);
+}
+
+/* Free the block referenced by ptr, which was last allocated (or
+ * reallocated) with size bytes. Trusting size, a block that can go on a
+ * quick list gets there without its header being read: a block asked
+ * for with less than MM_MMAP_THRESHOLD bytes is never a mapping of its
+ * own, and the quick list for its requested size only promises blocks at
+ * least that big. Caller holds the heap lock.
+ * Build with -DMM_DEBUG to check size against the slab or the block;
+ * the checks read the very header and slab metadata this path skips. */
+void heap_free_sized(void *ptr, size_t size)
+{
+    if(ptr == NULL){
+        return;
+    }
+
+    if(size <= SLAB_MAX_SIZE && is_slab_object(ptr)){
+#ifdef MM_DEBUG
+        assert(size <= object_slab(ptr)->objectSize);
+#endif
+        slab_free(ptr);
+        return;
+    }
+
+    //huge sizes may or may not be mappings, the header knows
+    if(use_mmap(size)){
+        heap_free(ptr);
+        return;
+    }
+
+    Block_t *block = payload_block(ptr);
+    size_t request_size = request_block_size(size);
+#ifdef MM_DEBUG
+    assert(!is_mmapped(block) && block_size(block) >= request_size &&
+           block_size(block) - request_size < MIN_BLOCK_SIZE);
+#endif
+
+    if(request_size <= QUICK_MAX_SIZE){
+        int bin = quick_bin(request_size);
+        if(malloc_info->quick_counts[bin] == MM_QUICK_COUNT){
+            quick_flush_bin(bin);
+        }
+        if(malloc_info->quick_counts[bin] < MM_QUICK_COUNT){
+            quick_push(bin, block);
+            return;
+        }
+    }
+
+    release_block(block);
+}
+
+/* qsort order for payload pointers: by address */
+static int compare_addresses(const void *a, const void *b)
+{
+    char *x = *(char *const *)a;
+    char *y = *(char *const *)b;
+    return (x > y) - (x < y);
+}
+
+/* Free the n blocks in ptrs (NULLs are skipped). They are sorted by
+ * address first, so that each run of neighbouring heap blocks becomes a
+ * single free block and is coalesced once, instead of once per block.
+ * Caller holds the heap lock. */
+void heap_free_batch(void **ptrs, size_t n)
+{
+    qsort(ptrs, n, sizeof(void *), compare_addresses);
+
+    size_t i = 0;
+    while(i < n){
+        if(ptrs[i] == NULL || is_slab_object(ptrs[i]) || is_mmapped(payload_block(ptrs[i]))){
+            heap_free(ptrs[i++]);
+            continue;
+        }
+
+        //how far does the run of neighbours starting here go?
+        Block_t *block = payload_block(ptrs[i]);
+        Block_t *last = block;
+        size_t total = block_size(block);
+        size_t j = i + 1;
+        while(j < n && ptrs[j] == block_payload(UNSCALED_POINTER_ADD(block, total))){
+            last = payload_block(ptrs[j++]);
+            total += block_size(last);
+        }
+
+        //a lone block is freed as usual
+        if(j == i + 1){
+            heap_free(ptrs[i++]);
+            continue;
+        }
+
+        //the run becomes one allocated block, which is then freed
+        header_store(block, total | BLOCK_ALLOC | (header_load(block) & PREV_FREE));
+        if(malloc_info->malloc_list_tail == last){
+            malloc_info->malloc_list_tail = block;
+        }
+        release_block(block);
+        i = j;
+    }
+}
+
+/* Resize the block referenced by ptr to size bytes, keeping its contents.
+ * Shrinks in place by splitting, grows in place by absorbing a free next
+ * block and/or extending the heap when the block is the tail. Only moves
+ * (malloc + copy + free) when none of that works. Returns the resized
+ * payload, or NULL if it had to move and there was no room for it, in
+ * which case ptr is left allocated and untouched.
+ * ptr is not NULL and size is not zero. Caller holds the heap lock.
+ */
+void *heap_realloc(void *ptr, size_t size)
+{
+    //objects in a slab can't grow, they fit or they move
+    if(is_slab_object(ptr)){
+        size_t objectSize = object_slab(ptr)->objectSize;
+        if(size <= objectSize){
+            return ptr;
+        }
+        void *newPtr = heap_malloc(size);
+        if(newPtr == NULL){
+            return NULL;
+        }
+        memcpy(newPtr, ptr, objectSize);
+        slab_free(ptr);
+        return newPtr;
+    }
+
+    Block_t *block = payload_block(ptr);
+    size_t oldSize = block_size(block);
+    size_t request_size = request_block_size(size);
+
+    //a huge block stays mapped and lets mremap do the copying,
+    //unless it got small enough to move back into the heap
+    if(is_mmapped(block)){
+        if(use_mmap(size)){
+            return mmap_realloc(block, size);
+        }
+        void *newPtr = heap_malloc(size);
+        if(newPtr == NULL){
+            return NULL;
+        }
+        memcpy(newPtr, ptr, size);
+        mmap_free(block);
+        return newPtr;
+    }
+
+    //SHRINKING (or same size): give the tail end back if it makes a block
+    if(request_size <= oldSize){
+        if(oldSize - request_size >= MIN_BLOCK_SIZE){
+            split(block, request_size);
+            coalesce(next_block(block));
+        }
+        return ptr;
+    }
+
+    //GROWING IN PLACE: absorb the next block if it is free
+    Block_t *nextBlock = next_block(block);
+    if(nextBlock && is_free(nextBlock) &&
+       (nextBlock == malloc_info->malloc_list_tail ||
+        oldSize + block_size(nextBlock) >= request_size)){
+
+        remove_free_node(nextBlock);
+        set_allocated(block, oldSize + block_size(nextBlock));
+
+        if(malloc_info->malloc_list_tail == nextBlock){
+            malloc_info->malloc_list_tail = block;
+        }
+    }
+
+    //GROWING THE TAIL: only ask the heap for what is still missing
+    if(block == malloc_info->malloc_list_tail && block_size(block) < request_size &&
+       request_more_space(request_size - block_size(block))){
+        set_allocated(block, request_size);
+    }
+
+    if(block_size(block) >= request_size){
+        //we may have absorbed more than we need
+        if(block_size(block) - request_size >= MIN_BLOCK_SIZE){
+            split(block, request_size);
+        }
+        return ptr;
+    }
+
+    //LAST RESORT: move the payload to a new block
+    void *newPtr = heap_malloc(size);
+    if(newPtr == NULL){
+        return NULL;
+    }
+    memcpy(newPtr, ptr, oldSize - sizeof(BlockInfo_t));
+    heap_free(ptr);
+    return newPtr;
+}
+
+// TOP-LEVEL ALLOCATOR INTERFACE ------------------------------------
+
+#ifdef MM_THREAD_SAFE
+/* Thread caches.
+ * In the thread-safe build the central heap (everything above) sits behind
+ * heap_lock. In front of it every thread keeps a small cache of chunks it
+ * freed, one LIFO list per size, linked through the first word of the
+ * payload. Cached chunks stay marked allocated in the heap, so any thread
+ * may cache a chunk no matter which thread allocated it, and malloc/free
+ * pairs of cached sizes never take the lock. A cache is flushed back to the
+ * heap when its thread exits. */
+#define TCACHE_MAX_SIZE 1024
+#define TCACHE_BINS (TCACHE_MAX_SIZE / ALIGNMENT)
+#ifndef MM_TCACHE_COUNT
+#define MM_TCACHE_COUNT 32
+#endif
+
+typedef struct
+{
+    void *bins[TCACHE_BINS];                // Cached chunks, one list per size
+    unsigned int counts[TCACHE_BINS];       // Number of chunks in each list
+    unsigned long generation;               // tcache_generation the chunks belong to
+} tcache_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static __thread tcache_t tcache;
+static unsigned long tcache_generation = 1;
+
+#define LOCK_HEAP() pthread_mutex_lock(&heap_lock)
+#define UNLOCK_HEAP() pthread_mutex_unlock(&heap_lock)
+
+/* Remote frees.
+ * A free that misses the thread cache has to go back to the central heap.
+ * In a producer/consumer pipeline that is every free on the consumer side,
+ * and those frees would queue up on heap_lock behind the producer's mallocs.
+ * Instead, when the lock is busy the chunk is pushed onto the heap's
+ * remote_frees stack with a single CAS and the free returns right away.
+ * Whoever takes the lock next (usually the producer's next malloc) drains
+ * the whole stack in one go. Pushed chunks are still marked allocated and
+ * are linked through the first word of the payload, the same word a free
+ * block uses for freeNode.nextFree.
+ * Build with -DMM_REMOTE_FREE=0 to always wait for the lock instead. */
+#ifndef MM_REMOTE_FREE
+#define MM_REMOTE_FREE 1
+#endif
+
+/* Push a chunk onto the remote free stack, from any thread, no lock needed.
+ * Only the lock holder ever pops, and it takes the whole stack at once,
+ * so there is no ABA problem. */
+static inline void remote_free_push(void *ptr)
+{
+    void *head = __atomic_load_n(&main_arena.remote_frees, __ATOMIC_RELAXED);
+    do{
+        *(void **)ptr = head;
+    } while(!__atomic_compare_exchange_n(&main_arena.remote_frees, &head, ptr, 1,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Free every chunk on the remote free stack. Caller holds the heap lock. */
+static inline void remote_free_drain()
+{
+    //cheap check first, the stack is empty nearly all the time
+    if(__atomic_load_n(&main_arena.remote_frees, __ATOMIC_RELAXED) == NULL){
+        return;
+    }
+    void *ptr = __atomic_exchange_n(&main_arena.remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while(ptr){
+        void *next = *(void **)ptr;
+        heap_free(ptr);
+        ptr = next;
+    }
+}
+
+/* Cache bin for a malloc request, -1 if that size isn't cached.
+ * Small requests use their slab class, bigger ones their block size,
+ * so every chunk in a bin has room for every request mapped to it. */
+static inline int tcache_request_bin(size_t size)
+{
+    size_t key = size <= SLAB_MAX_SIZE ? size : request_block_size(size);
+    int bin = (key + ALIGNMENT - 1) / ALIGNMENT - 1;
+    return bin < TCACHE_BINS ? bin : -1;
+}
+
+/* Cache bin for an allocated chunk, the same keys as above.
+ * Blocks no bigger than SLAB_MAX_SIZE (left by realloc shrinking) would
+ * land in a slab class bin they're too small for, so they aren't cached. */
+static inline int tcache_chunk_bin(void *ptr)
+{
+    size_t key;
+    if(is_slab_object(ptr)){
+        key = object_slab(ptr)->objectSize;
+    }
+    else{
+        key = block_size(payload_block(ptr));
+        if(key <= SLAB_MAX_SIZE){
+            return -1;
+        }
+    }
+    int bin = key / ALIGNMENT - 1;
+    return bin < TCACHE_BINS ? bin : -1;
+}
+
+/* Give every chunk in this thread's cache back to the central heap.
+ * Caller holds the heap lock. */
+static void tcache_flush(tcache_t *cache)
+{
+    for(int i = 0; i < TCACHE_BINS; i++){
+        while(cache->bins[i]){
+            void *ptr = cache->bins[i];
+            cache->bins[i] = *(void **)ptr;
+            if(cache->generation == tcache_generation){
+                heap_free(ptr);
+            }
+        }
+        cache->counts[i] = 0;
+    }
+}
+
+/* pthread key destructor: flush the cache of an exiting thread */
+static void tcache_thread_exit(void *arg)
+{
+    LOCK_HEAP();
+    remote_free_drain();
+    tcache_flush(&tcache);
+    UNLOCK_HEAP();
+}
+
+static void tcache_make_key()
+{
+    pthread_key_create(&tcache_key, tcache_thread_exit);
+}
+
+/* Make sure this thread's cache belongs to the current heap and will be
+ * flushed when the thread exits. */
+static inline tcache_t *tcache_get()
+{
+    if(tcache.generation != tcache_generation){
+        //first use in this thread, or mm_init threw the old heap away
+        memset(&tcache, 0, sizeof(tcache));
+        tcache.generation = tcache_generation;
+        pthread_once(&tcache_key_once, tcache_make_key);
+        pthread_setspecific(tcache_key, &tcache);
+    }
+    return &tcache;
+}
+
+/* Pop a chunk for a size byte request off this thread's cache, NULL if
+ * there is none. */
+static inline void *tcache_malloc(size_t size)
+{
+    int bin = tcache_request_bin(size);
+    if (bin >= 0){
+        tcache_t *cache = tcache_get();
+        void *ptr = cache->bins[bin];
+        if (ptr){
+            cache->bins[bin] = *(void **)ptr;
+            cache->counts[bin]--;
+            return ptr;
+        }
+    }
+    return NULL;
+}
+#else
+#define LOCK_HEAP()
+#define UNLOCK_HEAP()
+#define remote_free_drain()
+#endif
+
+/* Start an empty heap for arena at the current end of region.
+ * Returns -1 if the region has no room for it. */
+static int arena_init(malloc_info_t *arena, mem_region_t *region)
+{
+    for(int i = 0; i < NUM_SIZE_CLASSES; i++){
+        arena->free_lists[i] = NULL;
+    }
+    arena->rover = NULL;
+    arena->free_tree = 0;
+    for(int i = 0; i < FL_COUNT; i++){
+        arena->sl_bitmap[i] = 0;
+    }
+    arena->fl_bitmap = 0;
+    for(int i = 0; i < NUM_SLAB_CLASSES; i++){
+        arena->slabs[i] = NULL;
+    }
+    arena->empty_slabs = NULL;
+    arena->num_empty_slabs = 0;
+    //only the words a slab was ever marked in can be dirty
+    memset(arena->slab_map, 0, arena->slab_map_used * sizeof(unsigned long));
+    arena->slab_map_used = 0;
+    arena->slabs_full = 0;
+    for(int i = 0; i < QUICK_BINS; i++){
+        arena->quick_lists[i] = NULL;
+        arena->quick_counts[i] = 0;
+    }
+    arena->quick_bitmap = 0;
+    arena->malloc_list_tail = NULL;
+    arena->region = region;
+    arena->heap_start = (char *)mem_region_hi(region) + 1;
+
+    //pad the start of the heap so that payloads come out aligned
+    malloc_info = arena;
+    void *padding = request_more_space(HEAP_PADDING);
+    malloc_info = &main_arena;
+    return padding ? 0 : -1;
+}
+
+/* Initialize the allocator. */
+int mm_init()
+{
+    // Modify this function only if you add variables that need to be initialized.
+    // This will be called ONCE at the beginning of execution
+    if(arena_init(&main_arena, mem_default_region()) < 0){
+        return -1;
+    }
+
+#ifdef MM_THREAD_SAFE
+    //whatever the thread caches still hold belongs to the old heap
+    tcache_generation++;
+    main_arena.remote_frees = NULL;
+#endif
+
+    return 0;
+}
+
+/* Allocate a block of size size and return a pointer to it. If size is zero,
+ * returns null.
+ */
+void *mm_malloc(size_t size)
+{
+    // Zero-size requests get NULL.
+    if (size == 0){
+        return NULL;
+    }
+
+#ifdef MM_THREAD_SAFE
+    //most requests are served from this thread's cache without the lock
+    void *cached = tcache_malloc(size);
+    if (cached){
+        return cached;
+    }
+#endif
+
+    LOCK_HEAP();
+    remote_free_drain();
+    void *ptr = heap_malloc(size);
+    UNLOCK_HEAP();
+    return ptr;
+}
+
+/* Zero the size bytes at ptr, a block heap_malloc just handed out, except
+ * for what is known to be zero already. dirty_end is the heap's dirty
+ * watermark from before the block was allocated: the bytes from there up
+ * came straight from fresh memlib pages, and the only ones heap_malloc
+ * may have written are the header and free list links extend_heap put
+ * at dirty_end, the links at the start of the payload and the footer at
+ * the end of the block. */
+static void calloc_clear(void *ptr, size_t size, char *dirty_end)
+{
+    char *start = (char *)ptr;
+    char *end = start + size;
+
+    //slab objects are small and the slab header could be anywhere
+    if(is_slab_object(ptr)){
+        memset(ptr, 0, size);
+        return;
+    }
+
+    //a new mapping is all zero
+    Block_t *block = payload_block(ptr);
+    if(is_mmapped(block)){
+        return;
+    }
+
+    //everything below the watermark plus the block extend_heap started
+    //there, and at least the free list links
+    char *clean = dirty_end + sizeof(Block_t);
+    if(clean < start + sizeof(FreeBlockInfo_t)){
+        clean = start + sizeof(FreeBlockInfo_t);
+    }
+    if(clean > end){
+        clean = end;
+    }
+    memset(start, 0, clean - start);
+
+    //the footer the block had while it was free (the payload ends in it)
+    char *footer = (char *)block_footer(block);
+    if(footer >= clean && footer < end){
+        memset(footer, 0, end - footer);
+    }
+}
+
+/* Allocate a zeroed array of nmemb elements of size bytes each. Returns
+ * NULL if the total size is zero or doesn't fit in a size_t.
+ * Only the bytes that may be dirty get cleared, see calloc_clear. */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    if(size != 0 && nmemb > (size_t)-1 / size){
+        return NULL;
+    }
+    size_t bytes = nmemb * size;
+    if(bytes == 0){
+        return NULL;
+    }
+
+#ifdef MM_THREAD_SAFE
+    //a cached chunk has been used before, clear all of it
+    void *cached = tcache_malloc(bytes);
+    if(cached){
+        memset(cached, 0, bytes);
+        return cached;
+    }
+#endif
+
+    LOCK_HEAP();
+    remote_free_drain();
+    char *dirty_end = mem_region_dirty_end(main_arena.region);
+    void *ptr = heap_malloc(bytes);
+    UNLOCK_HEAP();
+
+    if(ptr){
+        calloc_clear(ptr, bytes, dirty_end);
+    }
+    return ptr;
+}
+
+/* Allocate size bytes aligned to alignment, which must be a power of two.
+ * Returns NULL if it isn't or size is zero. */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    if(alignment == 0 || (alignment & (alignment - 1))){
+        return NULL;
+    }
+    if(alignment <= ALIGNMENT){
+        return mm_malloc(size);
+    }
+
+    LOCK_HEAP();
+    remote_free_drain();
+    void *ptr = heap_memalign(alignment, size);
+    UNLOCK_HEAP();
+    return ptr;
+}
+
+/* C11 aligned_alloc: same as mm_memalign. */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+/* POSIX posix_memalign: alignment must be a power of two and a multiple of
+ * sizeof(void *). Stores the block in *memptr and returns 0, or returns
+ * EINVAL or ENOMEM and leaves *memptr alone. */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if(alignment == 0 || alignment % sizeof(void *) != 0 || (alignment & (alignment - 1))){
+        return EINVAL;
+    }
+    void *ptr = mm_memalign(alignment, size);
+    if(ptr == NULL && size != 0){
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/* Free the block referenced by ptr. */
+void mm_free(void *ptr)
+{
+    if(ptr == NULL){
+        return;
+    }
+
+#ifdef MM_THREAD_SAFE
+    //park it in this thread's cache if there's room
+    int bin = tcache_chunk_bin(ptr);
+    if (bin >= 0){
+        tcache_t *cache = tcache_get();
+        if (cache->counts[bin] < MM_TCACHE_COUNT){
+            *(void **)ptr = cache->bins[bin];
+            cache->bins[bin] = ptr;
+            cache->counts[bin]++;
+            return;
+        }
+    }
+#endif
+
+#if defined(MM_THREAD_SAFE) && MM_REMOTE_FREE
+    //don't wait behind another thread, leave the chunk for the lock holder
+    if(pthread_mutex_trylock(&heap_lock) != 0){
+        remote_free_push(ptr);
+        return;
+    }
+#else
+    LOCK_HEAP();
+#endif
+    remote_free_drain();
+    heap_free(ptr);
+    UNLOCK_HEAP();
+}
+
+/* Allocate n blocks of size bytes into ptrs, return how many we got. */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs)
+{
+    LOCK_HEAP();
+    remote_free_drain();
+    size_t done = heap_malloc_batch(size, n, ptrs);
+    UNLOCK_HEAP();
+    return done;
+}
+
+/* Free the n blocks in ptrs, reordering ptrs. */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    LOCK_HEAP();
+    remote_free_drain();
+    heap_free_batch(ptrs, n);
+    UNLOCK_HEAP();
+}
+
+/* Free the block referenced by ptr, allocated with size bytes. */
+void mm_free_sized(void *ptr, size_t size)
+{
+    if(ptr == NULL){
+        return;
+    }
+
+#ifdef MM_THREAD_SAFE
+    //the cache bin comes from size as well; a heap block of slab object
+    //size is too small for the slab class bin, as in tcache_chunk_bin
+    int bin = -1;
+    if (size > SLAB_MAX_SIZE || is_slab_object(ptr)){
+        bin = tcache_request_bin(size);
+    }
+    if (bin >= 0){
+        tcache_t *cache = tcache_get();
+        if (cache->counts[bin] < MM_TCACHE_COUNT){
+            *(void **)ptr = cache->bins[bin];
+            cache->bins[bin] = ptr;
+            cache->counts[bin]++;
+            return;
+        }
+    }
+#endif
+
+#if defined(MM_THREAD_SAFE) && MM_REMOTE_FREE
+    if(pthread_mutex_trylock(&heap_lock) != 0){
+        remote_free_push(ptr);
+        return;
+    }
+#else
+    LOCK_HEAP();
+#endif
+    remote_free_drain();
+    heap_free_sized(ptr, size);
+    UNLOCK_HEAP();
+}
+
+/* Resize the block referenced by ptr to size bytes, keeping its contents. */
+void *mm_realloc(void *ptr, size_t size)
+{
+    //realloc(NULL, size) is malloc, realloc(ptr, 0) is free
+    if(ptr == NULL){
+        return mm_malloc(size);
+    }
+    if(size == 0){
+        mm_free(ptr);
+        return NULL;
+    }
+
+    LOCK_HEAP();
+    remote_free_drain();
+    void *newPtr = heap_realloc(ptr, size);
+    UNLOCK_HEAP();
+    return newPtr;
+}
+
+/* Give the free memory at the end of the heap back, keeping pad bytes.
+ * Returns 1 if the heap got smaller, 0 otherwise. */
+int mm_trim(size_t pad)
+{
+    LOCK_HEAP();
+    remote_free_drain();
+    quick_flush();
+    int trimmed = heap_trim(pad);
+    UNLOCK_HEAP();
+    return trimmed;
+}
+
+/* Create an arena of up to max_size bytes (memlib's MAX_HEAP if 0) in a
+ * region of its own. The arena's bookkeeping, and a slab map sized for
+ * the region, sit at the front of the region, so destroying it is just
+ * giving the region back. */
+mm_arena_t *mm_arena_create(size_t max_size)
+{
+    mem_region_t *region = mem_region_create(max_size);
+    if(region == NULL){
+        return NULL;
+    }
+    size_t span = region->max_addr - region->start_brk;
+    if(span > MM_SLAB_SPAN){
+        span = MM_SLAB_SPAN;
+    }
+    size_t words = (span / SLAB_SIZE + SLAB_MAP_BITS - 1) / SLAB_MAP_BITS;
+    size_t header = (sizeof(malloc_info_t) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    size_t map = (words * sizeof(unsigned long) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    malloc_info_t *arena = mem_region_sbrk(region, header + map);
+    if(arena == (void *)-1){
+        mem_region_destroy(region);
+        return NULL;
+    }
+    //a fresh region is all zeroes, so the map starts out clear
+    arena->slab_map = (unsigned long *)((char *)arena + header);
+    arena->slab_map_words = words;
+    arena->slab_map_used = 0;
+#ifdef MM_THREAD_SAFE
+    arena->remote_frees = NULL;
+#endif
+    if(arena_init(arena, region) < 0){
+        mem_region_destroy(region);
+        return NULL;
+    }
+    return arena;
+}
+
+/* Allocate size bytes from arena. Returns NULL if size is zero or the
+ * arena has no room left for it; freeing blocks makes room again. */
+void *mm_arena_malloc(mm_arena_t *arena, size_t size)
+{
+    if(size == 0){
+        return NULL;
+    }
+    malloc_info = arena;
+    void *ptr = heap_malloc(size);
+    malloc_info = &main_arena;
+    return ptr;
+}
+
+/* Allocate size bytes aligned to alignment (a power of two) from arena.
+ * Returns NULL like mm_arena_malloc, or if alignment isn't one. */
+void *mm_arena_memalign(mm_arena_t *arena, size_t alignment, size_t size)
+{
+    if(alignment == 0 || (alignment & (alignment - 1))){
+        return NULL;
+    }
+    malloc_info = arena;
+    void *ptr = heap_memalign(alignment, size);
+    malloc_info = &main_arena;
+    return ptr;
+}
+
+/* Free a block that came from mm_arena_malloc or mm_arena_memalign on the
+ * same arena. */
+void mm_arena_free(mm_arena_t *arena, void *ptr)
+{
+    if(ptr == NULL){
+        return;
+    }
+    malloc_info = arena;
+    heap_free(ptr);
+    malloc_info = &main_arena;
+}
+
+/* Throw away arena and every block still allocated from it. */
+void mm_arena_destroy(mm_arena_t *arena)
+{
+    mem_region_destroy(arena->region);
 }
 
 /**********************************************************************
@@ -602,93 +2415,216 @@ void mm_free(void *ptr)
  *     first_block and heap_size
  **********************************************************************/
 
+/* Print a free (sub)tree in order, children in parentheses. */
+static void print_tree(Block_t *root)
+{
+    if (!root)
+        return;
+    fprintf(stderr, "(");
+    print_tree(ref_block(root->treeNode.left));
+    fprintf(stderr, " %p:%ld ", (void *)root, (long)block_size(root));
+    print_tree(ref_block(root->treeNode.right));
+    fprintf(stderr, ")");
+}
+
 /* Print the heap by iterating through it as an implicit free list. */
 void examine_heap()
 {
     /* print to stderr so output isn't buffered and not output if we crash */
     Block_t *curr = (Block_t *)first_block();
-    Block_t *end = (Block_t *)UNSCALED_POINTER_ADD(first_block(), heap_size());
+    Block_t *end = (Block_t *)UNSCALED_POINTER_ADD(malloc_info->heap_start, heap_size());
     fprintf(stderr, "====================================================\n");
     fprintf(stderr, "heap size:\t0x%lx\n", heap_size());
     fprintf(stderr, "heap start:\t%p\n", curr);
     fprintf(stderr, "heap end:\t%p\n", end);
 
-    fprintf(stderr, "free_list_head: %p\n", (void *)malloc_info.free_list_head);
-
-    fprintf(stderr, "malloc_list_tail: %p\n", (void *)malloc_info.malloc_list_tail);
+    fprintf(stderr, "malloc_list_tail: %p\n", (void *)malloc_info->malloc_list_tail);
 
     while (curr && curr < end)
     {
         /* print out common block attributes */
-        fprintf(stderr, "%p: %ld\t", (void *)curr, curr->info.size);
+        fprintf(stderr, "%p: %ld%s\t", (void *)curr, (long)block_size(curr),
+                (header_load(curr) & PREV_FREE) ? " (prev free)" : "");
 
         /* and allocated/free specific data */
-        if (curr->info.size > 0)
+        if (!is_free(curr))
+        {
+            fprintf(stderr, "ALLOCATED\n");
+        }
+        else if (block_size(curr) >= MM_TREE_CUTOFF)
         {
-            fprintf(stderr, "ALLOCATED\tprev: %p\n", (void *)curr->info.prev);
+            fprintf(stderr, "FREE\tleft: %p, right: %p, footer: %ld\n", (void *)ref_block(curr->treeNode.left), (void *)ref_block(curr->treeNode.right), (long)*block_footer(curr));
         }
         else
         {
-            fprintf(stderr, "FREE\tnextFree: %p, prevFree: %p, prev: %p\n", (void *)curr->freeNode.nextFree, (void *)curr->freeNode.prevFree, (void *)curr->info.prev);
+            fprintf(stderr, "FREE\tnextFree: %p, prevFree: %p, footer: %ld\n", (void *)ref_block(curr->freeNode.nextFree), (void *)ref_block(curr->freeNode.prevFree), (long)*block_footer(curr));
         }
 
         curr = next_block(curr);
     }
     fprintf(stderr, "END OF HEAP\n\n");
 
-    curr = malloc_info.free_list_head;
-    fprintf(stderr, "Head ");
-    while (curr)
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++)
     {
-        fprintf(stderr, "-> %p ", curr);
-        curr = curr->freeNode.nextFree;
+        curr = malloc_info->free_lists[i];
+        if (!curr)
+            continue;
+        fprintf(stderr, "Class %d ", i);
+        while (curr)
+        {
+            fprintf(stderr, "-> %p ", curr);
+            curr = ref_block(curr->freeNode.nextFree);
+        }
+        fprintf(stderr, "\n");
+    }
+    if (malloc_info->free_tree)
+    {
+        fprintf(stderr, "Tree ");
+        print_tree(ref_block(malloc_info->free_tree));
+        fprintf(stderr, "\n");
+    }
+}
+
+/* Checks a free (sub)tree strictly between lo and hi (NULL: unbounded) for
+ * key order, priority order and size, returns how many blocks it holds. */
+static long int check_tree(Block_t *root, Block_t *lo, Block_t *hi)
+{
+    if (!root)
+        return 0;
+    if (!is_free(root) || block_size(root) < MM_TREE_CUTOFF ||
+        (lo && !tree_before(lo, root)) || (hi && !tree_before(root, hi)))
+    {
+        fprintf(stderr, "check_heap: Error: free tree block %p is out of order.\n", (void *)root);
+        examine_heap();
+    }
+    Block_t *left = ref_block(root->treeNode.left);
+    Block_t *right = ref_block(root->treeNode.right);
+    if ((left && tree_priority(left) > tree_priority(root)) ||
+        (right && tree_priority(right) > tree_priority(root)))
+    {
+        fprintf(stderr, "check_heap: Error: free tree is not a heap at %p.\n", (void *)root);
+        examine_heap();
     }
-    fprintf(stderr, "\n");
+    return 1 + check_tree(left, lo, root) + check_tree(right, root, hi);
 }
 
 /* Checks the heap data structure for consistency. */
 int check_heap()
 {
     Block_t *curr = (Block_t *)first_block();
-    Block_t *end = (Block_t *)UNSCALED_POINTER_ADD(first_block(), heap_size());
+    Block_t *end = (Block_t *)UNSCALED_POINTER_ADD(malloc_info->heap_start, heap_size());
     Block_t *last = NULL;
     long int free_count = 0;
 
     while (curr && curr < end)
     {
-        if (curr->info.prev != last)
+        if (!(header_load(curr) & PREV_FREE) != !(last && is_free(last)))
         {
-            fprintf(stderr, "check_heap: Error: previous link not correct.\n");
+            fprintf(stderr, "check_heap: Error: PREV_FREE bit not correct.\n");
             examine_heap();
         }
 
-        if (curr->info.size <= 0)
+        if (is_free(curr))
         {
             // Free
             free_count++;
+
+            if (*block_footer(curr) != (tag_t)block_size(curr))
+            {
+                fprintf(stderr, "check_heap: Error: footer does not match header.\n");
+                examine_heap();
+            }
+            if (last && is_free(last))
+            {
+                fprintf(stderr, "check_heap: Error: two free blocks in a row.\n");
+                examine_heap();
+            }
         }
 
         last = curr;
         curr = next_block(curr);
     }
 
-    curr = malloc_info.free_list_head;
-    last = NULL;
-    while (curr)
+    if (last != malloc_info->malloc_list_tail)
     {
-        if (curr == last)
+        fprintf(stderr, "check_heap: Error: malloc_list_tail is not the last block.\n");
+        examine_heap();
+    }
+
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++)
+    {
+        curr = malloc_info->free_lists[i];
+        last = NULL;
+        if (!curr != !(malloc_info->sl_bitmap[i / SL_COUNT] & (1UL << (i % SL_COUNT))) ||
+            (curr && !(malloc_info->fl_bitmap & (1UL << (i / SL_COUNT)))))
         {
-            fprintf(stderr, "check_heap: Error: free list is circular.\n");
+            fprintf(stderr, "check_heap: Error: TLSF bitmaps out of sync with free list %d.\n", i);
             examine_heap();
         }
-        last = curr;
-        curr = curr->freeNode.nextFree;
-        if (free_count == 0)
+        while (curr)
         {
-            fprintf(stderr, "check_heap: Error: free list has more items than expected.\n");
+            if (curr == last)
+            {
+                fprintf(stderr, "check_heap: Error: free list is circular.\n");
+                examine_heap();
+            }
+            if (size_class(block_size(curr)) != i)
+            {
+                fprintf(stderr, "check_heap: Error: free block filed in the wrong size class.\n");
+                examine_heap();
+            }
+            last = curr;
+            curr = ref_block(curr->freeNode.nextFree);
+            if (free_count == 0)
+            {
+                fprintf(stderr, "check_heap: Error: free list has more items than expected.\n");
+                examine_heap();
+            }
+            free_count--;
+        }
+    }
+
+    if (check_tree(ref_block(malloc_info->free_tree), NULL, NULL) != free_count)
+    {
+        fprintf(stderr, "check_heap: Error: free blocks missing from the free lists and tree.\n");
+        examine_heap();
+    }
+
+    for (int i = 0; i < QUICK_BINS; i++)
+    {
+        int count = 0;
+        for (curr = malloc_info->quick_lists[i]; curr; curr = ref_block(curr->freeNode.nextFree))
+        {
+            if (is_free(curr) || block_size(curr) < (size_t)(i + 1) * ALIGNMENT || ++count > MM_QUICK_COUNT)
+            {
+                fprintf(stderr, "check_heap: Error: quick list %d holds a bad block %p.\n", i, (void *)curr);
+                examine_heap();
+                break;
+            }
+        }
+        if (count != malloc_info->quick_counts[i] ||
+            !count != !(malloc_info->quick_bitmap & (1UL << i)))
+        {
+            fprintf(stderr, "check_heap: Error: quick list %d count or bitmap is off.\n", i);
             examine_heap();
         }
-        free_count--;
+    }
+
+    for (int i = 0; i < NUM_SLAB_CLASSES; i++)
+    {
+        for (Slab_t *slab = malloc_info->slabs[i]; slab; slab = slab->nextSlab)
+        {
+            unsigned int used = 0;
+            for (int j = 0; j < SLAB_MAP_SLOTS; j++)
+            {
+                used += __builtin_popcountl(slab->usedMap[j]);
+            }
+            if (!is_slab_object(slab) || slab->objectSize != (i + 1) * ALIGNMENT ||
+                used != slab->numObjects - slab->numFree || slab->numFree == 0)
+            {
+                fprintf(stderr, "check_heap: Error: slab %p is inconsistent.\n", (void *)slab);
+            }
+        }
     }
 
     return 0;
@@ -1,26 +1,94 @@
 #include <stdio.h>
 #include <stddef.h> 
+
+/* Header and footer words, and the links between free blocks.
+ * With -DMM_COMPACT_HEADERS (for heaps under 4GB) they are 32 bits, and a
+ * link is the offset of a block from the heap start (0 for none), which
+ * halves the minimum block. Otherwise they are a long and a pointer. */
+#ifdef MM_COMPACT_HEADERS
+typedef unsigned int tag_t;
+typedef unsigned int block_ref_t;
+#else
+typedef long int tag_t;
+typedef struct _Block *block_ref_t;
+#endif
+
 typedef struct _BlockInfo
 {
-    long int size;
-    struct _Block *prev;
+    tag_t size;             // Size of block (header included) | BLOCK_ALLOC | PREV_FREE
 } BlockInfo_t;
 
 typedef struct _FreeBlockInfo
 {
-    struct _Block *nextFree;
-    struct _Block *prevFree;
+    block_ref_t nextFree;       // Explicit pointer to next free Block (stage 3)
+    block_ref_t prevFree;       // Explicit pointer to previous free Block (stage 3)
 } FreeBlockInfo_t;
 
+/* Large free blocks sit in a tree ordered by (size, address) instead of a list */
+typedef struct _FreeTreeInfo
+{
+    block_ref_t left;           // Subtree of free blocks ordered before this one
+    block_ref_t right;          // Subtree of free blocks ordered after this one
+} FreeTreeInfo_t;
+
 typedef struct _Block
 {
-    BlockInfo_t info;
-    FreeBlockInfo_t freeNode;
+    BlockInfo_t info;           // Composing both infos into a single struct
+    union
+    {
+        FreeBlockInfo_t freeNode;   //  Think: What does this mean in terms of memory?
+        FreeTreeInfo_t treeNode;    // The same words, for a block in the free tree
+    };
 } Block_t;
 
+/* Metadata at the start of a slab (a SLAB_SIZE-aligned run of small objects) */
+#define SLAB_MAP_SLOTS 4
+typedef struct _Slab
+{
+    struct _Slab *nextSlab;     // Next slab of this size class with a free slot
+    struct _Slab *prevSlab;     // Previous slab of this size class with a free slot
+    unsigned int objectSize;    // Size of every slot in this slab
+    unsigned int numObjects;    // Number of slots
+    unsigned int numFree;       // Number of slots not in use
+    unsigned long usedMap[SLAB_MAP_SLOTS];  // Bit set for every slot in use
+} Slab_t;
+
 extern int mm_init(void);
 extern void *mm_malloc(size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
 extern void mm_free(void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
+extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_trim(size_t pad);
+
+/* Batches: n blocks of one size carved out of a single free block, and n
+ * blocks freed together so that neighbours merge in one go. mm_free_batch
+ * reorders ptrs. */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **ptrs);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* Arenas: independent heaps, each in its own memlib region. Destroying an
+ * arena releases everything allocated from it at once. An arena must not
+ * be used by two threads at the same time. */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(size_t max_size);
+extern void *mm_arena_malloc(mm_arena_t *arena, size_t size);
+extern void *mm_arena_memalign(mm_arena_t *arena, size_t alignment, size_t size);
+extern void mm_arena_free(mm_arena_t *arena, void *ptr);
+extern void mm_arena_destroy(mm_arena_t *arena);
+
+/* The heap behind mm_malloc/mm_free/mm_realloc, working on the current
+ * arena (caller holds the heap lock for the main one) */
+extern void *heap_malloc(size_t size);
+extern void heap_free(void *ptr);
+extern void heap_free_sized(void *ptr, size_t size);
+extern void *heap_realloc(void *ptr, size_t size);
+extern void *heap_memalign(size_t alignment, size_t size);
+extern size_t heap_malloc_batch(size_t size, size_t n, void **ptrs);
+extern void heap_free_batch(void **ptrs, size_t n);
 
 
 extern Block_t *first_block();
@@ -29,10 +97,20 @@ extern void *request_more_space(size_t request_size);
 extern size_t heap_size();
 extern Block_t *search_list(size_t request_size); // Stage 1 search
 extern void split(Block_t *block, size_t size);
-extern void coalesce(Block_t *block);
+extern void carve(Block_t *block, size_t size, size_t n);
+extern Block_t *coalesce(Block_t *block);
+extern Block_t *extend_heap(size_t size);
+extern int heap_trim(size_t pad);
+extern Block_t *alloc_aligned_block(size_t alignment, size_t request_size);
+extern int size_class(size_t size);
 extern void insert_free_node(Block_t *block);
 extern void remove_free_node(Block_t *block);
 extern Block_t *search_free_list(size_t request_size); // Stage 3 search
+extern int is_slab_object(void *ptr);
+extern Slab_t *new_slab(size_t objectSize);
+extern void *slab_malloc(size_t size);
+extern void slab_free(void *ptr);
+extern int quick_flush();
 
 extern void examine_heap();
 extern int check_heap();
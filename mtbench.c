@@ -0,0 +1,395 @@
+/*
+ * mtbench.c - Multithreaded throughput benchmark for the thread-safe
+ *     build of mm.c (built by "make mtbench" with -DMM_THREAD_SAFE).
+ *
+ * Every thread runs the same random malloc/free loop over its own array
+ * of live blocks: pick a random slot, free it if it holds a block,
+ * otherwise malloc a block of random size and touch it. The benchmark
+ * runs the loop with 1, 2, ... N threads and reports the aggregate
+ * throughput and how it scales relative to one thread, optionally for
+ * libc malloc as well.
+ *
+ * With -p the threads are paired up into producers and consumers
+ * instead: the producer mallocs blocks and hands them to its consumer
+ * through a ring, and the consumer frees them, so every free is a
+ * cross-thread free.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* Default parameters */
+#define DEFAULT_OPS     1000000 /* malloc + free calls per thread */
+#define DEFAULT_SLOTS   256     /* live blocks per thread */
+#define DEFAULT_MAXSIZE 512     /* largest request in bytes */
+#define RING_SIZE       1024    /* blocks in flight per producer/consumer pair */
+
+/* The allocator under test */
+typedef struct {
+    char *name;
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+} allocator_t;
+
+/* Parameters for one benchmark thread */
+typedef struct {
+    allocator_t *alloc;
+    int ops;
+    int slots;
+    int maxsize;
+    unsigned int seed;
+} worker_t;
+
+/* Single producer, single consumer ring of blocks for -p */
+typedef struct {
+    char *slots[RING_SIZE];
+    unsigned long head;         /* next slot the producer fills */
+    unsigned long tail;         /* next slot the consumer empties */
+} ring_t;
+
+/* Parameters for one producer or consumer thread */
+typedef struct {
+    allocator_t *alloc;
+    ring_t *ring;
+    int ops;
+    int maxsize;
+    unsigned int seed;
+} pipe_worker_t;
+
+static allocator_t mm_alloc = { "mm", mm_malloc, mm_free };
+static allocator_t libc_alloc = { "libc", malloc, free };
+
+static void usage(void);
+static void unix_error(char *msg);
+
+/*
+ * now - wall clock time in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * random_size - request sizes skewed towards small objects, the way
+ *     real programs allocate: half of them are at most 64 bytes.
+ */
+static int random_size(unsigned int *seed, int maxsize)
+{
+    if (rand_r(seed) & 1)
+	return 1 + rand_r(seed) % (maxsize < 64 ? maxsize : 64);
+    return 1 + rand_r(seed) % maxsize;
+}
+
+/*
+ * worker - one benchmark thread: ops random malloc/free calls
+ */
+static void *worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    char **blocks;
+    int i, slot, size;
+
+    if ((blocks = calloc(w->slots, sizeof(char *))) == NULL)
+	unix_error("calloc failed in worker");
+
+    for (i = 0; i < w->ops; i++) {
+	slot = rand_r(&w->seed) % w->slots;
+	if (blocks[slot]) {
+	    w->alloc->free(blocks[slot]);
+	    blocks[slot] = NULL;
+	}
+	else {
+	    size = random_size(&w->seed, w->maxsize);
+	    if ((blocks[slot] = w->alloc->malloc(size)) == NULL) {
+		fprintf(stderr, "%s malloc failed\n", w->alloc->name);
+		exit(1);
+	    }
+	    blocks[slot][0] = blocks[slot][size - 1] = (char)i;
+	}
+    }
+
+    for (slot = 0; slot < w->slots; slot++)
+	if (blocks[slot])
+	    w->alloc->free(blocks[slot]);
+    free(blocks);
+    return NULL;
+}
+
+/*
+ * producer - malloc ops blocks and push them onto the ring
+ */
+static void *producer(void *arg)
+{
+    pipe_worker_t *w = (pipe_worker_t *)arg;
+    ring_t *ring = w->ring;
+    unsigned long head;
+    int i, size;
+
+    for (i = 0; i < w->ops; i++) {
+	size = random_size(&w->seed, w->maxsize);
+	head = ring->head;
+	while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+	    sched_yield();
+	if ((ring->slots[head % RING_SIZE] = w->alloc->malloc(size)) == NULL) {
+	    fprintf(stderr, "%s malloc failed\n", w->alloc->name);
+	    exit(1);
+	}
+	ring->slots[head % RING_SIZE][0] = (char)i;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * consumer - pop ops blocks off the ring and free them
+ */
+static void *consumer(void *arg)
+{
+    pipe_worker_t *w = (pipe_worker_t *)arg;
+    ring_t *ring = w->ring;
+    unsigned long tail;
+    int i;
+
+    for (i = 0; i < w->ops; i++) {
+	tail = ring->tail;
+	while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+	    sched_yield();
+	w->alloc->free(ring->slots[tail % RING_SIZE]);
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * run_pipe - run npairs producer/consumer pairs, return total ops per second
+ */
+static double run_pipe(allocator_t *alloc, int npairs, int ops, int maxsize)
+{
+    pthread_t *tids;
+    pipe_worker_t *workers;
+    ring_t *rings;
+    double start, secs;
+    int i;
+
+    tids = malloc(2 * npairs * sizeof(pthread_t));
+    workers = malloc(2 * npairs * sizeof(pipe_worker_t));
+    rings = calloc(npairs, sizeof(ring_t));
+    if (tids == NULL || workers == NULL || rings == NULL)
+	unix_error("malloc failed in run_pipe");
+
+    if (alloc == &mm_alloc) {
+	mem_reset_brk();
+	if (mm_init() < 0) {
+	    fprintf(stderr, "mm_init failed\n");
+	    exit(1);
+	}
+    }
+
+    start = now();
+    for (i = 0; i < 2 * npairs; i++) {
+	workers[i].alloc = alloc;
+	workers[i].ring = &rings[i / 2];
+	workers[i].ops = ops;
+	workers[i].maxsize = maxsize;
+	workers[i].seed = i / 2 + 1;
+	if ((errno = pthread_create(&tids[i], NULL, i % 2 ? consumer : producer,
+				    &workers[i])))
+	    unix_error("pthread_create failed");
+    }
+    for (i = 0; i < 2 * npairs; i++)
+	pthread_join(tids[i], NULL);
+    secs = now() - start;
+
+    free(tids);
+    free(workers);
+    free(rings);
+    /* one malloc and one free per block */
+    return 2.0 * npairs * ops / secs;
+}
+
+/*
+ * run - run the loop on nthreads threads, return total ops per second
+ */
+static double run(allocator_t *alloc, int nthreads, int ops, int slots,
+		  int maxsize)
+{
+    pthread_t *tids;
+    worker_t *workers;
+    double start, secs;
+    int i;
+
+    tids = malloc(nthreads * sizeof(pthread_t));
+    workers = malloc(nthreads * sizeof(worker_t));
+    if (tids == NULL || workers == NULL)
+	unix_error("malloc failed in run");
+
+    /* Every run starts from an empty mm heap */
+    if (alloc == &mm_alloc) {
+	mem_reset_brk();
+	if (mm_init() < 0) {
+	    fprintf(stderr, "mm_init failed\n");
+	    exit(1);
+	}
+    }
+
+    start = now();
+    for (i = 0; i < nthreads; i++) {
+	workers[i].alloc = alloc;
+	workers[i].ops = ops;
+	workers[i].slots = slots;
+	workers[i].maxsize = maxsize;
+	workers[i].seed = i + 1;
+	if ((errno = pthread_create(&tids[i], NULL, worker, &workers[i])))
+	    unix_error("pthread_create failed");
+    }
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    secs = now() - start;
+
+    free(tids);
+    free(workers);
+    return (double)nthreads * ops / secs;
+}
+
+int main(int argc, char **argv)
+{
+    int c, n, maxpairs;
+    int maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int ops = DEFAULT_OPS;
+    int slots = DEFAULT_SLOTS;
+    int maxsize = DEFAULT_MAXSIZE;
+    int run_libc = 0;
+    int pipeline = 0;
+    double mm_base = 0, libc_base = 0, mm_thru, libc_thru = 0;
+
+    while ((c = getopt(argc, argv, "t:n:w:s:lph")) != EOF) {
+	switch (c) {
+	case 't': /* Largest number of threads */
+	    maxthreads = atoi(optarg);
+	    break;
+	case 'n': /* Ops per thread */
+	    ops = atoi(optarg);
+	    break;
+	case 'w': /* Live blocks per thread */
+	    slots = atoi(optarg);
+	    break;
+	case 's': /* Largest request */
+	    maxsize = atoi(optarg);
+	    break;
+	case 'l': /* Run libc malloc as well */
+	    run_libc = 1;
+	    break;
+	case 'p': /* Producer/consumer pairs */
+	    pipeline = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (maxthreads < 1 || ops < 1 || slots < 1 || maxsize < 1) {
+	usage();
+	exit(1);
+    }
+
+    mem_init();
+
+    if (pipeline) {
+	/* n counts pairs here, so start at one pair of threads */
+	if (maxthreads < 2)
+	    maxthreads = 2;
+	printf("%d blocks per producer/consumer pair, sizes 1-%d\n",
+	       ops, maxsize);
+	printf("%7s %12s %8s", "pairs", "mm Kops/s", "scaling");
+	if (run_libc)
+	    printf(" %12s %8s", "libc Kops/s", "scaling");
+	printf("\n");
+
+	/* 1, 2, 4, ... pairs, and always finish with exactly maxthreads / 2 */
+	maxpairs = maxthreads / 2;
+	for (n = 1; n <= maxpairs;
+	     n = n < maxpairs && n * 2 > maxpairs ? maxpairs : n * 2) {
+	    mm_thru = run_pipe(&mm_alloc, n, ops, maxsize);
+	    if (n == 1)
+		mm_base = mm_thru;
+	    printf("%7d %12.0f %7.2fx", n, mm_thru / 1e3, mm_thru / mm_base);
+	    if (run_libc) {
+		libc_thru = run_pipe(&libc_alloc, n, ops, maxsize);
+		if (n == 1)
+		    libc_base = libc_thru;
+		printf(" %12.0f %7.2fx", libc_thru / 1e3, libc_thru / libc_base);
+	    }
+	    printf("\n");
+	}
+
+	mem_deinit();
+	exit(0);
+    }
+
+    printf("%d ops per thread, %d live blocks per thread, sizes 1-%d\n",
+	   ops, slots, maxsize);
+    printf("%7s %12s %8s", "threads", "mm Kops/s", "scaling");
+    if (run_libc)
+	printf(" %12s %8s", "libc Kops/s", "scaling");
+    printf("\n");
+
+    /* 1, 2, 4, ... threads, and always finish with exactly maxthreads */
+    for (n = 1; n <= maxthreads;
+	 n = n < maxthreads && n * 2 > maxthreads ? maxthreads : n * 2) {
+	mm_thru = run(&mm_alloc, n, ops, slots, maxsize);
+	if (n == 1)
+	    mm_base = mm_thru;
+	printf("%7d %12.0f %7.2fx", n, mm_thru / 1e3, mm_thru / mm_base);
+	if (run_libc) {
+	    libc_thru = run(&libc_alloc, n, ops, slots, maxsize);
+	    if (n == 1)
+		libc_base = libc_thru;
+	    printf(" %12.0f %7.2fx", libc_thru / 1e3, libc_thru / libc_base);
+	}
+	printf("\n");
+    }
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtbench [-hlp] [-t <threads>] [-n <ops>] [-w <slots>] [-s <size>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-n <ops>   malloc/free calls per thread (blocks per pair with -p).\n");
+    fprintf(stderr, "\t-p         Producer/consumer pairs: malloc on one thread, free on another.\n");
+    fprintf(stderr, "\t-s <size>  Largest request in bytes.\n");
+    fprintf(stderr, "\t-t <num>   Scale from 1 up to <num> threads.\n");
+    fprintf(stderr, "\t-w <slots> Live blocks per thread.\n");
+}
@@ -0,0 +1,385 @@
+/*
+ * mtreplay.c - Replay multithreaded traces against the thread-safe
+ *     build of mm.c (built by "make mtreplay" with -DMM_THREAD_SAFE).
+ *
+ * Every request in a trace can name the thread that makes it ("@thread"
+ * at the end of the line in a text trace, see trace.c). The replay splits
+ * the requests of each thread out into a stream of their own and runs
+ * every stream on a pthread of its own, all of them starting together.
+ *
+ * A request has to see the block that the request before it on the same
+ * id left behind. When that request belongs to another thread (a block
+ * malloc'd on one thread and freed or realloc'd on another) the two are
+ * ordered by a dependency barrier: every thread publishes how many of
+ * its requests are done, and the later request waits until the count
+ * has got past the one it depends on. A request only ever waits on an
+ * earlier one in trace order, so the replay cannot deadlock.
+ *
+ * The report gives each thread's requests, time and throughput, and the
+ * aggregate throughput over the wall time of the whole replay, for mm
+ * and, with -l, for libc malloc replayed the same way.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "trace.h"
+
+#define DEFAULT_RUNS 3  /* replays of each trace, the fastest one counts */
+#define CACHE_LINE   64
+
+/* The allocator under test */
+typedef struct {
+    char *name;
+    void *(*malloc)(size_t size);
+    void *(*calloc)(size_t nmemb, size_t size);
+    void *(*memalign)(size_t alignment, size_t size);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*free)(void *ptr);
+} allocator_t;
+
+/* One request of a stream, and the request of another thread it waits for */
+typedef struct {
+    traceop_t op;
+    int dep_thread;     /* thread of the request this one waits for, or -1 */
+    int dep_done;       /* ...and how many requests that thread must have done */
+} replay_op_t;
+
+struct replay;
+
+/* The requests of one thread. done is written by that thread alone and
+   read by every thread waiting on it, so it gets a cache line to itself */
+typedef struct {
+    unsigned long done;          /* requests finished so far */
+    char pad[CACHE_LINE - sizeof(unsigned long)];
+    struct replay *replay;
+    replay_op_t *ops;            /* the requests, in trace order */
+    int num_ops;
+    int waits;                   /* requests that found their barrier shut */
+    double secs;                 /* from the start to its last request */
+} stream_t;
+
+/* One replay of a trace */
+typedef struct replay {
+    allocator_t *alloc;
+    stream_t *streams;
+    int num_threads;
+    char **blocks;               /* the block of each id, shared by all */
+    int start;                   /* set once every thread is created */
+    double start_time;
+} replay_t;
+
+static allocator_t mm_alloc = {
+    "mm", mm_malloc, mm_calloc, mm_memalign, mm_realloc, mm_free
+};
+static allocator_t libc_alloc = {
+    "libc", malloc, calloc, aligned_alloc, realloc, free
+};
+
+static void usage(void);
+static void unix_error(char *msg);
+
+/*
+ * now - wall clock time in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * split_trace - split the requests of trace into one stream per thread,
+ *     and work out which ones wait on another thread. Returns the
+ *     streams and sets *cross to the number of requests that wait.
+ */
+static stream_t *split_trace(trace_t *trace, int *cross)
+{
+    stream_t *streams;
+    int *last_thread, *last_done;
+    const unsigned char *pos;
+    replay_op_t *r;
+    traceop_t op;
+    int i, t;
+
+    streams = calloc(trace->num_threads, sizeof(stream_t));
+    last_thread = malloc((trace->num_ids + 1) * sizeof(int));
+    last_done = malloc((trace->num_ids + 1) * sizeof(int));
+    if (streams == NULL || last_thread == NULL || last_done == NULL)
+	unix_error("malloc failed in split_trace");
+
+    /* Size the streams... */
+    for (i = 0, pos = trace->ops; i < trace->num_ops; i++) {
+	pos = trace_next(pos, &op);
+	streams[op.thread].num_ops++;
+    }
+    for (t = 0; t < trace->num_threads; t++) {
+	if ((streams[t].ops = malloc((streams[t].num_ops + 1) *
+				     sizeof(replay_op_t))) == NULL)
+	    unix_error("malloc failed in split_trace");
+	streams[t].num_ops = 0;
+    }
+
+    /* ...then fill them, remembering who touched each id last */
+    for (i = 0; i <= trace->num_ids; i++)
+	last_thread[i] = -1;
+    *cross = 0;
+    for (i = 0, pos = trace->ops; i < trace->num_ops; i++) {
+	pos = trace_next(pos, &op);
+	t = op.thread;
+	r = &streams[t].ops[streams[t].num_ops++];
+	r->op = op;
+	r->dep_thread = -1;
+	if (last_thread[op.index] >= 0 && last_thread[op.index] != t) {
+	    r->dep_thread = last_thread[op.index];
+	    r->dep_done = last_done[op.index];
+	    (*cross)++;
+	}
+	last_thread[op.index] = t;
+	last_done[op.index] = streams[t].num_ops;
+    }
+
+    free(last_thread);
+    free(last_done);
+    return streams;
+}
+
+/*
+ * replay_thread - replay one stream, waiting at its dependency barriers
+ */
+static void *replay_thread(void *arg)
+{
+    stream_t *s = (stream_t *)arg;
+    replay_t *replay = s->replay;
+    allocator_t *alloc = replay->alloc;
+    char **blocks = replay->blocks;
+    replay_op_t *r;
+    char *p = NULL;
+    int i;
+
+    while (!__atomic_load_n(&replay->start, __ATOMIC_ACQUIRE))
+	sched_yield();
+
+    for (i = 0; i < s->num_ops; i++) {
+	r = &s->ops[i];
+	if (r->dep_thread >= 0 &&
+	    __atomic_load_n(&replay->streams[r->dep_thread].done,
+			    __ATOMIC_ACQUIRE) < (unsigned long)r->dep_done) {
+	    s->waits++;
+	    while (__atomic_load_n(&replay->streams[r->dep_thread].done,
+				   __ATOMIC_ACQUIRE) < (unsigned long)r->dep_done)
+		sched_yield();
+	}
+
+	switch (r->op.type) {
+	case ALLOC:
+	    p = r->op.align ? alloc->memalign(r->op.align, r->op.size) :
+		alloc->malloc(r->op.size);
+	    blocks[r->op.index] = p;
+	    break;
+	case CALLOC:
+	    p = alloc->calloc(1, r->op.size);
+	    blocks[r->op.index] = p;
+	    break;
+	case REALLOC:
+	    p = alloc->realloc(blocks[r->op.index], r->op.size);
+	    blocks[r->op.index] = p;
+	    break;
+	case FREE:
+	    alloc->free(blocks[r->op.index]);
+	    blocks[r->op.index] = p = NULL;
+	    break;
+	}
+	if (p == NULL && r->op.type != FREE) {
+	    fprintf(stderr, "%s request failed on thread %d\n",
+		    alloc->name, r->op.thread);
+	    exit(1);
+	}
+
+	__atomic_store_n(&s->done, i + 1, __ATOMIC_RELEASE);
+    }
+
+    s->secs = now() - replay->start_time;
+    return NULL;
+}
+
+/*
+ * run_replay - replay the streams once with alloc, return the wall time
+ */
+static double run_replay(replay_t *replay, allocator_t *alloc)
+{
+    pthread_t *tids;
+    double secs;
+    int t;
+
+    if ((tids = malloc(replay->num_threads * sizeof(pthread_t))) == NULL)
+	unix_error("malloc failed in run_replay");
+
+    /* Every run starts from an empty mm heap */
+    if (alloc == &mm_alloc) {
+	mem_reset_brk();
+	if (mm_init() < 0) {
+	    fprintf(stderr, "mm_init failed\n");
+	    exit(1);
+	}
+    }
+
+    replay->alloc = alloc;
+    replay->start = 0;
+    for (t = 0; t < replay->num_threads; t++) {
+	replay->streams[t].done = 0;
+	replay->streams[t].waits = 0;
+	replay->streams[t].secs = 0;
+	if ((errno = pthread_create(&tids[t], NULL, replay_thread,
+				    &replay->streams[t])))
+	    unix_error("pthread_create failed");
+    }
+
+    replay->start_time = now();
+    __atomic_store_n(&replay->start, 1, __ATOMIC_RELEASE);
+    for (t = 0; t < replay->num_threads; t++)
+	pthread_join(tids[t], NULL);
+    secs = now() - replay->start_time;
+
+    free(tids);
+    return secs;
+}
+
+/*
+ * release_blocks - free the blocks a replay left allocated, untimed
+ */
+static void release_blocks(replay_t *replay, int num_ids)
+{
+    int i;
+
+    for (i = 0; i < num_ids; i++)
+	if (replay->blocks[i]) {
+	    replay->alloc->free(replay->blocks[i]);
+	    replay->blocks[i] = NULL;
+	}
+}
+
+/*
+ * report - print the fastest of runs replays of the trace with alloc
+ */
+static void report(replay_t *replay, allocator_t *alloc, int num_ids,
+		   int num_ops, int runs)
+{
+    stream_t *best;
+    double secs, best_secs = 0;
+    int i, t;
+
+    if ((best = malloc(replay->num_threads * sizeof(stream_t))) == NULL)
+	unix_error("malloc failed in report");
+
+    for (i = 0; i < runs; i++) {
+	secs = run_replay(replay, alloc);
+	release_blocks(replay, num_ids);
+	if (i == 0 || secs < best_secs) {
+	    best_secs = secs;
+	    memcpy(best, replay->streams, replay->num_threads * sizeof(stream_t));
+	}
+    }
+
+    printf("%s: %.6f secs, %.0f Kops/s\n", alloc->name, best_secs,
+	   num_ops / 1e3 / best_secs);
+    printf("%8s %10s %10s %10s %8s\n",
+	   "thread", "requests", "secs", "Kops/s", "waits");
+    for (t = 0; t < replay->num_threads; t++)
+	printf("%8d %10d %10.6f %10.0f %8d\n", t, best[t].num_ops,
+	       best[t].secs,
+	       best[t].secs > 0 ? best[t].num_ops / 1e3 / best[t].secs : 0,
+	       best[t].waits);
+    free(best);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, t, cross;
+    int runs = DEFAULT_RUNS;
+    int run_libc = 0;
+    trace_t trace;
+    replay_t replay;
+
+    while ((c = getopt(argc, argv, "n:lh")) != EOF) {
+	switch (c) {
+	case 'n': /* Replays of each trace */
+	    runs = atoi(optarg);
+	    break;
+	case 'l': /* Run libc malloc as well */
+	    run_libc = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (runs < 1 || optind == argc) {
+	usage();
+	exit(1);
+    }
+
+    mem_init();
+
+    for (i = optind; i < argc; i++) {
+	if (trace_load(argv[i], &trace) < 0)
+	    exit(1);
+
+	memset(&replay, 0, sizeof(replay));
+	replay.num_threads = trace.num_threads;
+	replay.streams = split_trace(&trace, &cross);
+	for (t = 0; t < replay.num_threads; t++)
+	    replay.streams[t].replay = &replay;
+	if ((replay.blocks = calloc(trace.num_ids + 1, sizeof(char *))) == NULL)
+	    unix_error("calloc failed in main");
+
+	printf("%s: %d threads, %d requests, %d wait on another thread\n",
+	       argv[i], trace.num_threads, trace.num_ops, cross);
+	report(&replay, &mm_alloc, trace.num_ids, trace.num_ops, runs);
+	if (run_libc)
+	    report(&replay, &libc_alloc, trace.num_ids, trace.num_ops, runs);
+
+	for (t = 0; t < replay.num_threads; t++)
+	    free(replay.streams[t].ops);
+	free(replay.streams);
+	free(replay.blocks);
+	trace_unload(&trace);
+    }
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtreplay [-hl] [-n <runs>] <trace>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-n <runs>  Replays of each trace, the fastest is reported.\n");
+}
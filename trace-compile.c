@@ -0,0 +1,33 @@
+/*
+ * trace-compile.c - Compile a text trace (.rep) into the binary format
+ *     of trace.h, which mdriver maps and replays without parsing.
+ *
+ * Usage: trace-compile <in.rep> <out>
+ *
+ * The input can also be a compiled trace, which is just copied.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+int main(int argc, char **argv)
+{
+    trace_t trace;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: %s <in.rep> <out>\n", argv[0]);
+	exit(1);
+    }
+
+    if (trace_load(argv[1], &trace) < 0)
+	exit(1);
+    if (trace_save(&trace, argv[2]) < 0)
+	exit(1);
+
+    printf("%s: %d requests, %d ids, %d threads, %lu bytes of requests\n",
+	   argv[2], trace.num_ops, trace.num_ids, trace.num_threads,
+	   (unsigned long)trace.ops_len);
+    trace_unload(&trace);
+    return 0;
+}
@@ -0,0 +1,370 @@
+/*
+ * trace.c - load and save allocator traces.
+ *
+ * A text trace (.rep) is a header of four numbers (suggested heap size,
+ * number of ids, number of requests, weight) followed by one request a
+ * line: "a id size [align]", "c id size", "r id size" or "f id". Any
+ * request can end in "@thread" to say which thread makes it in a
+ * multithreaded trace (thread 0 if it doesn't). The file is read in one
+ * go and parsed by hand straight into the packed request format of
+ * trace.h, which is never longer than the text.
+ *
+ * A compiled trace (see trace-compile) already is the packed format
+ * behind a trace_header_t, so it is mapped read-only and used from the
+ * mapping without copying, once check_ops has made sure that its
+ * requests are all there and make sense.
+ *
+ * Both loaders print what went wrong to stderr and return -1.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+/*
+ * put_varint - append value to a packed request at out
+ */
+static unsigned char *put_varint(unsigned char *out, unsigned value)
+{
+    while (value >= 0x80) {
+        *out++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+/*
+ * skip_blanks - move past spaces and tabs (and newlines too if lines)
+ */
+static const char *skip_blanks(const char *p, const char *end, int lines)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' ||
+                       (lines && *p == '\n')))
+        p++;
+    return p;
+}
+
+/*
+ * get_number - parse the unsigned number at *pos (after blanks, and
+ *     newlines if lines), return -1 if there isn't one
+ */
+static long get_number(const char **pos, const char *end, int lines)
+{
+    const char *p = skip_blanks(*pos, end, lines);
+    long value = 0;
+
+    if (p == end || *p < '0' || *p > '9')
+        return -1;
+    while (p < end && *p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+    *pos = p;
+    return value;
+}
+
+/*
+ * bad_request - is a request's size or alignment one no allocator should
+ *     be asked for: more than TRACE_MAX, or an alignment that isn't a
+ *     power of two (0 is no alignment at all)
+ */
+static int bad_request(unsigned long size, unsigned long align)
+{
+    return size > TRACE_MAX || align > TRACE_MAX || (align & (align - 1));
+}
+
+/*
+ * parse_text - pack the text trace in text[0..len) into trace
+ */
+static int parse_text(const char *path, const char *text, size_t len,
+                      trace_t *trace)
+{
+    const char *p = text;
+    const char *end = text + len;
+    unsigned char *ops, *out;
+    long header[4], index, size, align, thread, max_index = -1;
+    long max_thread = 0;
+    int i, op_count = 0;
+    char type;
+
+    for (i = 0; i < 4; i++) {
+        if ((header[i] = get_number(&p, end, 1)) < 0) {
+            fprintf(stderr, "%s: bad trace header\n", path);
+            return -1;
+        }
+    }
+    trace->sugg_heapsize = header[0];
+    trace->num_ids = header[1];
+    trace->num_ops = header[2];
+    trace->weight = header[3];
+
+    if ((ops = malloc(len + 1)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return -1;
+    }
+    out = ops;
+
+    /* read every request line in the trace file */
+    while ((p = skip_blanks(p, end, 1)) < end) {
+        type = *p++;
+        if (type != 'a' && type != 'c' && type != 'r' && type != 'f') {
+            fprintf(stderr, "%s: bogus type character (%c) in request %d\n",
+                    path, type, op_count);
+            free(ops);
+            return -1;
+        }
+        index = get_number(&p, end, 0);
+        size = type == 'f' ? 0 : get_number(&p, end, 0);
+        /* optional alignment on the same line */
+        align = type == 'a' ? get_number(&p, end, 0) : -1;
+        /* and the thread making it */
+        thread = 0;
+        if ((p = skip_blanks(p, end, 0)) < end && *p == '@') {
+            p++;
+            thread = get_number(&p, end, 0);
+        }
+        if (index < 0 || size < 0 || thread < 0 || index > TRACE_MAX ||
+            thread > TRACE_MAX || bad_request(size, align > 0 ? align : 0)) {
+            fprintf(stderr, "%s: malformed request %d\n", path, op_count);
+            free(ops);
+            return -1;
+        }
+
+        *out++ = (type == 'a' ? ALLOC : type == 'c' ? CALLOC :
+                  type == 'r' ? REALLOC : FREE) |
+                 (align > 0 ? TRACE_ALIGNED : 0) |
+                 (thread > 0 ? TRACE_THREAD : 0);
+        out = put_varint(out, index);
+        if (type != 'f')
+            out = put_varint(out, size);
+        if (align > 0)
+            out = put_varint(out, align);
+        if (thread > 0)
+            out = put_varint(out, thread);
+
+        if (type != 'f' && index > max_index)
+            max_index = index;
+        if (thread > max_thread)
+            max_thread = thread;
+        op_count++;
+    }
+
+    if (max_index != trace->num_ids - 1 || op_count != trace->num_ops) {
+        fprintf(stderr, "%s: header says %d ids and %d requests, "
+                "found %ld and %d\n", path, trace->num_ids, trace->num_ops,
+                max_index + 1, op_count);
+        free(ops);
+        return -1;
+    }
+
+    trace->num_threads = max_thread + 1;
+    trace->ops = ops;
+    trace->ops_len = out - ops;
+    trace->base = ops;
+    trace->length = 0;
+    return 0;
+}
+
+/*
+ * get_varint - trace_varint that stops at end, return -1 if the varint
+ *     doesn't fit before it
+ */
+static int get_varint(const unsigned char **pos, const unsigned char *end,
+                      unsigned *value)
+{
+    const unsigned char *p = *pos;
+    int shift = 0;
+
+    *value = 0;
+    do {
+        if (p == end || shift > 28)
+            return -1;
+        *value |= (unsigned)(*p & 0x7f) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    *pos = p;
+    return 0;
+}
+
+/*
+ * check_ops - make sure that the requests of a compiled trace decode to
+ *     exactly num_ops requests on valid ids and threads, with sizes and
+ *     alignments bad_request takes, in ops_len bytes, so that trace_next
+ *     can't run off the end of a truncated or corrupt file
+ */
+static int check_ops(const char *path, const trace_t *trace)
+{
+    const unsigned char *p = trace->ops;
+    const unsigned char *end = trace->ops + trace->ops_len;
+    unsigned index, size, align, thread;
+    unsigned char type;
+    int i;
+
+    if (trace->num_ids < 0 || trace->num_ops < 0 || trace->num_threads < 1) {
+        fprintf(stderr, "%s: bad compiled trace header\n", path);
+        return -1;
+    }
+    for (i = 0; i < trace->num_ops; i++) {
+        if (p == end)
+            break;
+        type = *p++;
+        size = align = thread = 0;
+        if ((type & ~(0x3 | TRACE_ALIGNED | TRACE_THREAD)) ||
+            get_varint(&p, end, &index) < 0 ||
+            ((type & 0x3) != FREE && get_varint(&p, end, &size) < 0) ||
+            ((type & TRACE_ALIGNED) && get_varint(&p, end, &align) < 0) ||
+            ((type & TRACE_THREAD) && get_varint(&p, end, &thread) < 0) ||
+            index >= (unsigned)trace->num_ids ||
+            ((type & TRACE_ALIGNED) && align == 0) ||
+            bad_request(size, align) ||
+            thread >= (unsigned)trace->num_threads) {
+            fprintf(stderr, "%s: corrupt request %d in compiled trace\n",
+                    path, i);
+            return -1;
+        }
+    }
+    if (i != trace->num_ops || p != end) {
+        fprintf(stderr, "%s: compiled trace has %d requests in %lu bytes, "
+                "header says %d in %lu\n", path, i,
+                (unsigned long)(p - trace->ops), trace->num_ops,
+                (unsigned long)trace->ops_len);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * trace_load - load the text or compiled trace at path into trace
+ */
+int trace_load(const char *path, trace_t *trace)
+{
+    struct stat st;
+    const trace_header_t *header;
+    void *map;
+    int fd, rc;
+
+    memset(trace, 0, sizeof(*trace));
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s: empty trace\n", path);
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    /* a compiled trace is replayed right out of the mapping */
+    header = (const trace_header_t *)map;
+    if ((size_t)st.st_size >= sizeof(header->magic) &&
+        memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic) - 1) == 0 &&
+        header->magic[sizeof(header->magic) - 1] !=
+        TRACE_MAGIC[sizeof(header->magic) - 1]) {
+        fprintf(stderr, "%s: compiled trace of another version, "
+                "run trace-compile on its .rep again\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    if ((size_t)st.st_size >= sizeof(trace_header_t) &&
+        memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) == 0) {
+        if (header->ops_len > st.st_size - sizeof(trace_header_t)) {
+            fprintf(stderr, "%s: truncated compiled trace\n", path);
+            munmap(map, st.st_size);
+            return -1;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        trace->sugg_heapsize = header->sugg_heapsize;
+        trace->num_ids = header->num_ids;
+        trace->num_ops = header->num_ops;
+        trace->weight = header->weight;
+        trace->num_threads = header->num_threads;
+        trace->ops = (const unsigned char *)(header + 1);
+        trace->ops_len = header->ops_len;
+        trace->base = map;
+        trace->length = st.st_size;
+        if (check_ops(path, trace) < 0) {
+            trace_unload(trace);
+            return -1;
+        }
+        return 0;
+    }
+
+    /* a text one is packed into memory of its own */
+    rc = parse_text(path, map, st.st_size, trace);
+    munmap(map, st.st_size);
+    return rc;
+}
+
+/*
+ * trace_unload - give back what trace_load took for trace
+ */
+void trace_unload(trace_t *trace)
+{
+    if (trace->length)
+        munmap(trace->base, trace->length);
+    else
+        free(trace->base);
+    trace->base = NULL;
+    trace->ops = NULL;
+}
+
+/*
+ * trace_decode - the requests of trace decoded into an array, NULL if
+ *     there's no memory for it
+ */
+traceop_t *trace_decode(const trace_t *trace)
+{
+    const unsigned char *pos = trace->ops;
+    traceop_t *requests;
+    int i;
+
+    if ((requests = malloc((trace->num_ops + 1) * sizeof(traceop_t))) == NULL)
+        return NULL;
+    for (i = 0; i < trace->num_ops; i++)
+        pos = trace_next(pos, &requests[i]);
+    return requests;
+}
+
+/*
+ * trace_save - write trace out as a compiled trace at path
+ */
+int trace_save(const trace_t *trace, const char *path)
+{
+    trace_header_t header;
+    FILE *f;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.sugg_heapsize = trace->sugg_heapsize;
+    header.num_ids = trace->num_ids;
+    header.num_ops = trace->num_ops;
+    header.weight = trace->weight;
+    header.num_threads = trace->num_threads;
+    header.ops_len = trace->ops_len;
+
+    if ((f = fopen(path, "wb")) == NULL) {
+        fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(trace->ops, 1, trace->ops_len, f) != trace->ops_len ||
+        fclose(f) != 0) {
+        fprintf(stderr, "Could not write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - allocator traces, loaded from text (.rep) files or from
+ *     compiled ones (see trace.c and trace-compile).
+ *
+ * Either way a loaded trace keeps its requests packed, one after the
+ * other, and trace_next decodes them in order. A compiled trace is just
+ * the header below followed by those packed requests, so loading one is
+ * a single mmap. Replays decode every request before they start timing:
+ * mdriver into an array with trace_decode, mtreplay into per-thread
+ * streams.
+ */
+#include <stddef.h>
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC, CALLOC} type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+    int align;                        /* alignment asked for by alloc, 0 if none */
+    int thread;                       /* thread that makes the request */
+} traceop_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    int num_threads;     /* number of threads making requests */
+    const unsigned char *ops; /* the requests, packed (see trace_next) */
+    size_t ops_len;      /* bytes at ops */
+    void *base;          /* what trace_unload gives back... */
+    size_t length;       /* ...and how big it is, 0 if it was malloc'd */
+    traceop_t *requests; /* the requests, decoded (see trace_decode) */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+} trace_t;
+
+/*
+ * Compiled trace layout: trace_header_t, then ops_len bytes of requests.
+ * A request is one byte with its type (and TRACE_ALIGNED if it has an
+ * alignment, TRACE_THREAD if it isn't made by thread 0), then as varints
+ * (7 bits a byte, low bits first, high bit set on all but the last byte)
+ * its index, its size unless it's a free, its alignment if it has one
+ * and its thread if it has one. Numbers are in host byte order.
+ */
+#define TRACE_MAGIC "mmtrace2"
+#define TRACE_ALIGNED 0x4
+#define TRACE_THREAD  0x8
+
+/* Largest id, size, alignment or thread a request may have: they all
+   end up in the ints of a traceop_t */
+#define TRACE_MAX 0x7fffffff
+
+typedef struct {
+    char magic[8];          /* TRACE_MAGIC */
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+    int num_threads;
+    int unused;
+    unsigned long ops_len;  /* bytes of requests after the header */
+} trace_header_t;
+
+int trace_load(const char *path, trace_t *trace);
+void trace_unload(trace_t *trace);
+int trace_save(const trace_t *trace, const char *path);
+traceop_t *trace_decode(const trace_t *trace);
+
+/* Decode the varint at *pos and move *pos past it */
+static inline unsigned trace_varint(const unsigned char **pos)
+{
+    const unsigned char *p = *pos;
+    unsigned value = *p & 0x7f;
+    int shift = 7;
+
+    while (*p++ & 0x80) {
+        value |= (unsigned)(*p & 0x7f) << shift;
+        shift += 7;
+    }
+    *pos = p;
+    return value;
+}
+
+/* Decode the request at pos into op, return where the next one starts.
+ * Only safe on requests trace_load has accepted; nothing here is timed. */
+static inline const unsigned char *trace_next(const unsigned char *pos,
+                                              traceop_t *op)
+{
+    unsigned char type = *pos++;
+
+    op->type = type & 0x3;
+    op->index = trace_varint(&pos);
+    op->size = op->type == FREE ? 0 : trace_varint(&pos);
+    op->align = (type & TRACE_ALIGNED) ? trace_varint(&pos) : 0;
+    op->thread = (type & TRACE_THREAD) ? trace_varint(&pos) : 0;
+    return pos;
+}
+
+#endif /* __TRACE_H_ */
@@ -0,0 +1,518 @@
+/*
+ * tracegen.c - Generate synthetic allocator traces (.rep) from
+ *     parameterised workload models.
+ *
+ * A trace is a sequence of phases. During a phase the working set (the
+ * number of live blocks) ramps linearly from where the last phase left
+ * it to the phase's target: each request is a malloc or a free, with the
+ * odds tilted towards whichever brings the working set closer to the
+ * target. A phase can also switch to another size model, so a trace can
+ * change its allocation pattern half way through.
+ *
+ * Size models (-z, or the tail of a -p):
+ *     uniform:MIN:MAX        every size in MIN..MAX equally likely
+ *     power:MIN:MAX:ALPHA    bounded power law, small sizes most likely
+ *     bimodal:A:B:PCT        around A (PCT% of requests) or around B
+ *     hist:FILE              "size weight" lines, sizes drawn by weight
+ *
+ * Lifetime models (-t) pick the block that a free releases:
+ *     lifo                   the youngest live block
+ *     fifo                   the oldest live block
+ *     random                 any live block
+ *     tail:PCT               any live block, except that PCT% of the
+ *                            blocks live until the end of the trace
+ *
+ * With -g PCT[:FACTOR], PCT% of the requests instead grow the youngest
+ * live block by FACTOR with realloc, the way a buffer that is still
+ * being filled grows.
+ *
+ * Every id is allocated once, and whatever is still live at the end is
+ * freed, so the traces are balanced like the -bal ones. The generator
+ * has its own random number generator, so a seed always gives the same
+ * trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+/* Default parameters */
+#define DEFAULT_OPS     100000  /* requests in the single default phase */
+#define DEFAULT_LIVE    1000    /* working set it ramps up to */
+#define DEFAULT_SIZES   "power:8:4096:1"
+#define DEFAULT_SEED    1
+#define DEFAULT_FACTOR  1.5     /* realloc growth factor */
+#define MAX_PHASES      64
+#define MAX_SIZE        (1 << 28) /* no request grows past this */
+
+/* A size distribution */
+typedef struct {
+    enum {UNIFORM, POWER, BIMODAL, HIST} kind;
+    long min, max;       /* uniform and power: range of sizes */
+    double alpha;        /* power: exponent */
+    long a, b;           /* bimodal: the two modes... */
+    double pct;          /* ...and the share of the first one */
+    long *sizes;         /* hist: the sizes... */
+    double *cumulative;  /* ...and their cumulative weights */
+    int count;
+} sizes_t;
+
+/* One phase of the trace */
+typedef struct {
+    long ops;            /* requests in the phase */
+    long live;           /* working set at the end of the phase */
+    sizes_t sizes;       /* sizes allocated during the phase */
+} phase_t;
+
+/* How free picks its victim */
+enum {LIFO, FIFO, RANDOM, TAIL};
+
+/* The live blocks, oldest first, in a ring that grows as needed */
+typedef struct {
+    int *ids;
+    long head;           /* index of the oldest block */
+    long count;
+    long capacity;       /* always a power of two */
+} live_t;
+
+static unsigned long rng_state;
+
+static long num_ids = 0;         /* ids allocated so far */
+static long num_ops = 0;         /* requests written so far */
+static long *block_size = NULL;  /* size of each id */
+static long size_capacity = 0;
+static long live_bytes = 0, peak_bytes = 0;
+
+static char *out_buf = NULL;     /* the requests, until the header is known */
+static size_t out_len = 0, out_capacity = 0;
+
+static void usage(void);
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+/*
+ * rng_next - next number from a splitmix64 generator
+ */
+static unsigned long rng_next(void)
+{
+    unsigned long z = (rng_state += 0x9E3779B97F4A7C15UL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * rng_double - uniform in [0, 1)
+ */
+static double rng_double(void)
+{
+    return (rng_next() >> 11) * (1.0 / (1UL << 53));
+}
+
+/*
+ * rng_range - uniform in lo..hi
+ */
+static long rng_range(long lo, long hi)
+{
+    return lo + (long)(rng_next() % (unsigned long)(hi - lo + 1));
+}
+
+/*
+ * read_hist - load a histogram of sizes from path into s
+ */
+static void read_hist(sizes_t *s, char *path)
+{
+    FILE *f;
+    long size;
+    double weight, total = 0;
+    int capacity = 0;
+
+    if ((f = fopen(path, "r")) == NULL)
+	unix_error(path);
+    s->count = 0;
+    while (fscanf(f, "%ld %lf", &size, &weight) == 2) {
+	if (size < 1 || weight < 0)
+	    app_error("sizes and weights in a histogram must be positive");
+	if (s->count == capacity) {
+	    capacity = capacity ? 2 * capacity : 64;
+	    s->sizes = realloc(s->sizes, capacity * sizeof(long));
+	    s->cumulative = realloc(s->cumulative, capacity * sizeof(double));
+	    if (s->sizes == NULL || s->cumulative == NULL)
+		unix_error("realloc failed in read_hist");
+	}
+	total += weight;
+	s->sizes[s->count] = size;
+	s->cumulative[s->count++] = total;
+    }
+    fclose(f);
+    if (s->count == 0 || total <= 0)
+	app_error("empty size histogram");
+}
+
+/*
+ * parse_sizes - parse a size model spec into s
+ */
+static void parse_sizes(sizes_t *s, char *spec)
+{
+    memset(s, 0, sizeof(*s));
+    if (sscanf(spec, "uniform:%ld:%ld", &s->min, &s->max) == 2)
+	s->kind = UNIFORM;
+    else if (sscanf(spec, "power:%ld:%ld:%lf", &s->min, &s->max, &s->alpha) == 3)
+	s->kind = POWER;
+    else if (sscanf(spec, "bimodal:%ld:%ld:%lf", &s->a, &s->b, &s->pct) == 3)
+	s->kind = BIMODAL;
+    else if (strncmp(spec, "hist:", 5) == 0) {
+	s->kind = HIST;
+	read_hist(s, spec + 5);
+	return;
+    }
+    else {
+	fprintf(stderr, "tracegen: bad size model \"%s\"\n", spec);
+	exit(1);
+    }
+
+    if ((s->kind != BIMODAL && (s->min < 1 || s->max < s->min)) ||
+	(s->kind == POWER && s->alpha <= 0) ||
+	(s->kind == BIMODAL && (s->a < 1 || s->b < 1 ||
+				s->pct < 0 || s->pct > 100))) {
+	fprintf(stderr, "tracegen: bad parameters in \"%s\"\n", spec);
+	exit(1);
+    }
+}
+
+/*
+ * draw_size - a request size from s
+ */
+static long draw_size(sizes_t *s)
+{
+    double u = rng_double(), lo, hi;
+    long mode;
+    int first, last, mid;
+
+    switch (s->kind) {
+    case UNIFORM:
+	return rng_range(s->min, s->max);
+
+    case POWER:
+	/* invert the CDF of a power law bounded to min..max */
+	lo = pow((double)s->min, -s->alpha);
+	hi = pow((double)s->max + 1, -s->alpha);
+	return (long)pow(lo - u * (lo - hi), -1 / s->alpha);
+
+    case BIMODAL:
+	/* each mode spreads over an eighth either side */
+	mode = u * 100 < s->pct ? s->a : s->b;
+	return rng_range(mode - mode / 8 > 0 ? mode - mode / 8 : 1,
+			 mode + mode / 8);
+
+    case HIST:
+	u *= s->cumulative[s->count - 1];
+	for (first = 0, last = s->count - 1; first < last; ) {
+	    mid = (first + last) / 2;
+	    if (s->cumulative[mid] <= u)
+		first = mid + 1;
+	    else
+		last = mid;
+	}
+	return s->sizes[first];
+    }
+    return 1;
+}
+
+/*
+ * emit - append a request to the trace
+ */
+static void emit(char type, long id, long size)
+{
+    if (out_capacity - out_len < 64) {
+	out_capacity = out_capacity ? 2 * out_capacity : 1 << 20;
+	if ((out_buf = realloc(out_buf, out_capacity)) == NULL)
+	    unix_error("realloc failed in emit");
+    }
+    if (type == 'f')
+	out_len += sprintf(out_buf + out_len, "f %ld\n", id);
+    else
+	out_len += sprintf(out_buf + out_len, "%c %ld %ld\n", type, id, size);
+    num_ops++;
+}
+
+/*
+ * The live set: a ring of ids in allocation order, so LIFO and FIFO take
+ * from either end, and random takes from anywhere, filling the hole from
+ * the young end (order doesn't matter to random).
+ */
+static void live_push(live_t *l, int id)
+{
+    long i, old = l->capacity;
+    int *ids;
+
+    if (l->count == l->capacity) {
+	l->capacity = old ? 2 * old : 1024;
+	if ((ids = malloc(l->capacity * sizeof(int))) == NULL)
+	    unix_error("malloc failed in live_push");
+	for (i = 0; i < l->count; i++)
+	    ids[i] = l->ids[(l->head + i) & (old - 1)];
+	free(l->ids);
+	l->ids = ids;
+	l->head = 0;
+    }
+    l->ids[(l->head + l->count++) & (l->capacity - 1)] = id;
+}
+
+static int *live_at(live_t *l, long i)
+{
+    return &l->ids[(l->head + i) & (l->capacity - 1)];
+}
+
+static int live_take(live_t *l, long i)
+{
+    int id = *live_at(l, i);
+
+    if (i == 0) {
+	l->head = (l->head + 1) & (l->capacity - 1);
+	l->count--;
+    }
+    else
+	*live_at(l, i) = *live_at(l, --l->count);
+    return id;
+}
+
+/*
+ * do_malloc - allocate a new id from sizes, and keep it in live (or
+ *     among the blocks that live to the end, long)
+ */
+static void do_malloc(sizes_t *sizes, live_t *live, live_t *tail,
+		      int lifetime, double tail_pct)
+{
+    long size = draw_size(sizes);
+
+    if (num_ids == size_capacity) {
+	size_capacity = size_capacity ? 2 * size_capacity : 1 << 16;
+	if ((block_size = realloc(block_size, size_capacity * sizeof(long))) == NULL)
+	    unix_error("realloc failed in do_malloc");
+    }
+    block_size[num_ids] = size;
+    live_bytes += size;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+
+    if (lifetime == TAIL && rng_double() * 100 < tail_pct)
+	live_push(tail, num_ids);
+    else
+	live_push(live, num_ids);
+    emit('a', num_ids++, size);
+}
+
+/*
+ * do_free - free the block of live that the lifetime model picks
+ */
+static void do_free(live_t *live, int lifetime)
+{
+    long i;
+    int id;
+
+    if (lifetime == LIFO)
+	i = live->count - 1;
+    else if (lifetime == FIFO)
+	i = 0;
+    else
+	i = rng_range(0, live->count - 1);
+    id = live_take(live, i);
+    live_bytes -= block_size[id];
+    emit('f', id, 0);
+}
+
+/*
+ * do_realloc - grow the youngest live block by factor, return 0 if it
+ *     would get too big
+ */
+static int do_realloc(live_t *live, double factor)
+{
+    int id = *live_at(live, live->count - 1);
+    long size = (long)(block_size[id] * factor) + 1;
+
+    if (size > MAX_SIZE)
+	return 0;
+    live_bytes += size - block_size[id];
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+    block_size[id] = size;
+    emit('r', id, size);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, lifetime = RANDOM, num_phases = 0;
+    long ops = DEFAULT_OPS, target_live = DEFAULT_LIVE, n, from, target;
+    double tail_pct = 0, grow_pct = 0, factor = DEFAULT_FACTOR, p;
+    char *size_spec = DEFAULT_SIZES, *outfile = NULL, *colon;
+    char *phase_specs[MAX_PHASES];
+    phase_t phases[MAX_PHASES];
+    sizes_t default_sizes;
+    live_t live, tail;
+    FILE *out = stdout;
+
+    rng_state = DEFAULT_SEED;
+    while ((c = getopt(argc, argv, "n:w:z:t:g:p:s:o:h")) != EOF) {
+	switch (c) {
+	case 'n': /* Requests in the default phase */
+	    ops = atol(optarg);
+	    break;
+	case 'w': /* Working set of the default phase */
+	    target_live = atol(optarg);
+	    break;
+	case 'z': /* Size model */
+	    size_spec = optarg;
+	    break;
+	case 't': /* Lifetime model */
+	    if (strcmp(optarg, "lifo") == 0)
+		lifetime = LIFO;
+	    else if (strcmp(optarg, "fifo") == 0)
+		lifetime = FIFO;
+	    else if (strcmp(optarg, "random") == 0)
+		lifetime = RANDOM;
+	    else if (sscanf(optarg, "tail:%lf", &tail_pct) == 1 &&
+		     tail_pct >= 0 && tail_pct <= 100)
+		lifetime = TAIL;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'g': /* Realloc growth */
+	    if (sscanf(optarg, "%lf:%lf", &grow_pct, &factor) < 1 ||
+		grow_pct < 0 || grow_pct > 100 || factor <= 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'p': /* One more phase */
+	    if (num_phases == MAX_PHASES)
+		app_error("too many phases");
+	    phase_specs[num_phases++] = optarg;
+	    break;
+	case 's': /* Seed */
+	    rng_state = strtoul(optarg, NULL, 0);
+	    break;
+	case 'o': /* Output file */
+	    outfile = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind != argc || ops < 1 || target_live < 1) {
+	usage();
+	exit(1);
+    }
+
+    /* Without -p the trace is one phase of -n requests */
+    parse_sizes(&default_sizes, size_spec);
+    for (i = 0; i < num_phases; i++) {
+	if (sscanf(phase_specs[i], "%ld:%ld", &phases[i].ops,
+		   &phases[i].live) != 2 || phases[i].ops < 1 ||
+	    phases[i].live < 1) {
+	    fprintf(stderr, "tracegen: bad phase \"%s\"\n", phase_specs[i]);
+	    exit(1);
+	}
+	colon = strchr(strchr(phase_specs[i], ':') + 1, ':');
+	if (colon)
+	    parse_sizes(&phases[i].sizes, colon + 1);
+	else
+	    phases[i].sizes = default_sizes;
+    }
+    if (num_phases == 0) {
+	phases[0].ops = ops;
+	phases[0].live = target_live;
+	phases[0].sizes = default_sizes;
+	num_phases = 1;
+    }
+
+    memset(&live, 0, sizeof(live));
+    memset(&tail, 0, sizeof(tail));
+    from = 0;
+    for (i = 0; i < num_phases; i++) {
+	for (n = 0; n < phases[i].ops; n++) {
+	    /* the working set ramps from the last phase's to this one's */
+	    target = from + (phases[i].live - from) * (n + 1) / phases[i].ops;
+
+	    if (live.count > 0 && grow_pct > 0 &&
+		rng_double() * 100 < grow_pct && do_realloc(&live, factor))
+		continue;
+
+	    /* malloc more often below the target, free more often above */
+	    p = (double)(target - live.count) / (target / 10 + 1);
+	    p = 0.5 + 0.45 * (p > 1 ? 1 : p < -1 ? -1 : p);
+	    if (live.count == 0 || rng_double() < p)
+		do_malloc(&phases[i].sizes, &live, &tail, lifetime, tail_pct);
+	    else
+		do_free(&live, lifetime);
+	}
+	from = phases[i].live;
+    }
+
+    /* Balance the trace: the working set goes, then the long-lived tail */
+    while (live.count > 0)
+	do_free(&live, lifetime);
+    while (tail.count > 0)
+	do_free(&tail, FIFO);
+
+    if (outfile && (out = fopen(outfile, "w")) == NULL)
+	unix_error(outfile);
+    fprintf(out, "%ld\n%ld\n%ld\n%d\n", peak_bytes, num_ids, num_ops, 1);
+    if (fwrite(out_buf, 1, out_len, out) != out_len ||
+	(outfile && fclose(out) != 0))
+	unix_error("write failed");
+
+    fprintf(stderr, "%ld requests, %ld ids, %ld bytes live at the peak\n",
+	    num_ops, num_ids, peak_bytes);
+    exit(0);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    fprintf(stderr, "tracegen: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "tracegen: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-h] [-n <ops>] [-w <live>] [-z <sizes>] [-t <lifetimes>]\n"
+	    "                [-g <pct>[:<factor>]] [-p <ops>:<live>[:<sizes>]]... [-s <seed>] [-o <file>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-g <pct>[:<factor>]  Grow the youngest block by <factor> (%.1f) with realloc in <pct>%% of requests.\n", DEFAULT_FACTOR);
+    fprintf(stderr, "\t-h                   Print this message.\n");
+    fprintf(stderr, "\t-n <ops>             Requests, when there are no phases (%d).\n", DEFAULT_OPS);
+    fprintf(stderr, "\t-o <file>            Write the trace to <file> instead of stdout.\n");
+    fprintf(stderr, "\t-p <ops>:<live>[:<sizes>]\n"
+	    "\t                     Add a phase of <ops> requests ramping the working set to <live>\n"
+	    "\t                     blocks, allocating from <sizes> if given, -z otherwise.\n");
+    fprintf(stderr, "\t-s <seed>            Seed for the random number generator (%d).\n", DEFAULT_SEED);
+    fprintf(stderr, "\t-t <lifetimes>       lifo, fifo, random or tail:<pct> (random).\n");
+    fprintf(stderr, "\t-w <live>            Working set in blocks, when there are no phases (%d).\n", DEFAULT_LIVE);
+    fprintf(stderr, "\t-z <sizes>           uniform:<min>:<max>, power:<min>:<max>:<alpha>,\n"
+	    "\t                     bimodal:<a>:<b>:<pct> or hist:<file> (%s).\n", DEFAULT_SIZES);
+}